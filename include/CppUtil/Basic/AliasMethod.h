@@ -19,6 +19,8 @@ namespace CppUtil {
 			// 0, 1, ..., n - 1
 			int Sample() const;
 			int Sample(double & p) const;
+			// with a given u in [0, 1)
+			int Sample(double u, double & p) const;
 
 			double P(int i) const;
 
@@ -23,6 +23,11 @@ namespace CppUtil {
 			const Vec3 UniformOnSphere(float & pd);
 			float PDofUniformOnSphere();
 
+			// uniform in the cone around +z of the angle theta_max <= pi / 2
+			// the cone is given by sin^2(theta_max), precise for small cones like far spheres
+			const Vec3 UniformInCone(float sin2ThetaMax);
+			float PDofUniformInCone(float sin2ThetaMax);
+
 			const Vec3 CosOnHalfSphere();
 
 			const Vec3 CosOnSphere();
@@ -0,0 +1,46 @@
+#ifndef _CPPUTIL_BASIC_SAMPLER_DISTRIBUTION_2D_H_
+#define _CPPUTIL_BASIC_SAMPLER_DISTRIBUTION_2D_H_
+
+#include <CppUtil/Basic/UGM/Point2.h>
+
+#include <functional>
+#include <vector>
+
+namespace CppUtil {
+	namespace Basic {
+		// piecewise constant density on [0, 1]^2 over a grid of width x height cells
+		// a row is picked by the marginal distribution, then a cell by the conditional one of the row
+		// only the cumulative distributions are kept, a float per cell,
+		// and the probability of a cell is the difference of them, so the density of a sample is exactly its probability
+		class Distribution2D {
+		public:
+			// fillRow(y, row) writes the nonnegative function of the cells of row y into row[0, width)
+			// the rows are filled and summed in parallel
+			// a function of all 0 is taken as uniform
+			void Init(int width, int height, const std::function<void(int y, float * row)> & fillRow);
+
+			void Clear();
+
+			bool IsValid() const { return width > 0 && height > 0; }
+
+		public:
+			// continuous position in [0, 1)^2 from u0, u1 in [0, 1)
+			// @arg2 out, density on [0, 1]^2
+			const Point2 Sample(float u0, float u1, float & pd) const;
+
+			// density on [0, 1]^2 at the cell of pos
+			float PDF(const Point2 & pos) const;
+
+		private:
+			int width = 0;
+			int height = 0;
+
+			// height rows of width, cdf of a cell is the probability of the cells up to it in its row, the last one is 1
+			std::vector<float> conditionalCDFs;
+			// cdf of the rows
+			std::vector<float> marginalCDF;
+		};
+	}
+}
+
+#endif // !_CPPUTIL_BASIC_SAMPLER_DISTRIBUTION_2D_H_
@@ -0,0 +1,36 @@
+#ifndef _CPPUTIL_BASIC_SAMPLER_LOW_DISCREPANCY_H_
+#define _CPPUTIL_BASIC_SAMPLER_LOW_DISCREPANCY_H_
+
+#include <cstdint>
+
+namespace CppUtil {
+	namespace Basic {
+		namespace LowDiscrepancy {
+			// dimensions of the Sobol sequence, Joe and Kuo direction numbers
+			constexpr int SOBOL_DIMS = 16;
+			// prime bases of the Halton sequence
+			constexpr int HALTON_DIMS = 32;
+
+			// [0.0f, 1.0f)
+			float ToFloat(uint32_t x);
+
+			// 64 bit hash, well mixed
+			uint64_t MixBits(uint64_t x);
+
+			// dimension dim of point index of the Sobol sequence, as 32 bit fraction
+			// dim in [0, SOBOL_DIMS)
+			uint32_t Sobol(uint32_t index, int dim);
+
+			// Owen scrambling of a 32 bit fraction, a random permutation which keeps the strata
+			// Burley, Practical Hash-based Owen Scrambling, 2020
+			uint32_t OwenScramble(uint32_t x, uint32_t seed);
+
+			// Owen scrambled radical inverse of index in the prime base of dim
+			// each digit is permuted by a hash of the digits before it
+			// dim in [0, HALTON_DIMS)
+			float OwenScrambledRadicalInverse(int dim, uint64_t index, uint64_t seed);
+		}
+	}
+}
+
+#endif // !_CPPUTIL_BASIC_SAMPLER_LOW_DISCREPANCY_H_
@@ -6,6 +6,7 @@
 #include <string>
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 
 namespace CppUtil {
 	namespace Basic {
@@ -59,22 +60,42 @@ namespace CppUtil {
 			template<typename T>
 			T Abs(T v) { return v < 0 ? -v : v; }
 
-			// [-0x7FFFFFFFF, 0x7FFFFFFF]
+			// numbers of a sampler instead of the generator, see SetRandSource
+			class RandSource {
+			public:
+				// [0.0f, 1.0f)
+				virtual float Next1D() = 0;
+
+			protected:
+				virtual ~RandSource() = default;
+			};
+
+			// random numbers come from a generator of the calling thread
+			// [0, 0x7FFFFFFF]
 			int Rand_I();
 
 			// [0, 0xFFFFFFFF]
 			unsigned int Rand_UI();
 
-			// [0.0f, 1.0f]
+			// [0.0f, 1.0f)
 			float Rand_F();
-			// [0.0f, 1.0f]
+			// [0.0f, 1.0f)
 			float Rand_F_exclude1();
 
-			// [0.0, 1.0]
+			// [0.0, 1.0)
 			double Rand_D();
 
+			// restart the generator of the calling thread
+			// same seed and stream, same numbers, e.g. seed by sample index and stream by pixel
+			void RandSeed(uint64_t seed, uint64_t stream);
+
+			// only the generator of the calling thread
 			void RandSetSeedByCurTime();
 
+			// while source is set, Rand_F, Rand_F_exclude1 and Rand_D of the calling thread take its numbers
+			// nullptr restores the generator, the source is not owned
+			void SetRandSource(RandSource * source);
+
 			template <typename T>
 			T Mean(const std::vector<T> & data);
 
@@ -0,0 +1,70 @@
+#ifndef _BASIC_MATH_PCG32_H_
+#define _BASIC_MATH_PCG32_H_
+
+#include <cstdint>
+
+namespace CppUtil {
+	namespace Basic {
+		// PCG32 (XSH RR), 64 bit state, 32 bit output
+		// generators with the same seed but different streams are independent
+		// http://www.pcg-random.org
+		class PCG32 {
+		public:
+			PCG32(uint64_t seed = 0x853c49e6748fea9bULL, uint64_t stream = 0xda3e39cb94b95bdbULL) { Seed(seed, stream); }
+
+		public:
+			void Seed(uint64_t seed, uint64_t stream) {
+				state = 0u;
+				inc = (stream << 1u) | 1u;
+				NextUInt();
+				state += seed;
+				NextUInt();
+			}
+
+			// [0, 0xFFFFFFFF]
+			uint32_t NextUInt() {
+				const uint64_t oldState = state;
+				state = oldState * 0x5851f42d4c957f2dULL + inc;
+				const uint32_t xorShifted = static_cast<uint32_t>(((oldState >> 18u) ^ oldState) >> 27u);
+				const uint32_t rot = static_cast<uint32_t>(oldState >> 59u);
+				return (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31u));
+			}
+
+			// [0.0f, 1.0f), 24 bits
+			float NextFloat() {
+				return (NextUInt() >> 8) * (1.f / 16777216.f);
+			}
+
+			// [0.0, 1.0), 53 bits
+			double NextDouble() {
+				const uint64_t hi = NextUInt() >> 5;
+				const uint64_t lo = NextUInt() >> 6;
+				return (hi * 67108864.0 + lo) * (1.0 / 9007199254740992.0);
+			}
+
+			// skip delta numbers in O(log(delta))
+			void Advance(uint64_t delta) {
+				uint64_t curMult = 0x5851f42d4c957f2dULL;
+				uint64_t curPlus = inc;
+				uint64_t accMult = 1u;
+				uint64_t accPlus = 0u;
+				while (delta > 0) {
+					if (delta & 1) {
+						accMult *= curMult;
+						accPlus = accPlus * curMult + curPlus;
+					}
+					curPlus = (curMult + 1) * curPlus;
+					curMult *= curMult;
+					delta >>= 1;
+				}
+				state = accMult * state + accPlus;
+			}
+
+		private:
+			uint64_t state;
+			uint64_t inc; // odd, selects the stream
+		};
+	}
+}
+
+#endif//!_BASIC_MATH_PCG32_H_
@@ -0,0 +1,28 @@
+#ifndef _CPPUTIL_BASIC_SAMPLER_PMJ02_SAMPLER_H_
+#define _CPPUTIL_BASIC_SAMPLER_PMJ02_SAMPLER_H_
+
+#include <CppUtil/Basic/Sampler.h>
+
+namespace CppUtil {
+	namespace Basic {
+		// progressive multi-jittered (0, 2) samples, every 2D sample is stratified in all elementary intervals
+		// generated as Owen scrambled Sobol dimensions 0 and 1, which form a (0, 2) sequence,
+		// with the index shuffled per pixel and dimension, Helmer et al., Stochastic Generation of (t, s) Sample Sequences, 2021
+		class PMJ02Sampler : public Sampler {
+		public:
+			PMJ02Sampler(uint32_t seed = 0) : Sampler(seed) { }
+
+		public:
+			static const Ptr<PMJ02Sampler> New(uint32_t seed = 0) { return Basic::New<PMJ02Sampler>(seed); }
+
+		protected:
+			virtual ~PMJ02Sampler() = default;
+
+		protected:
+			virtual float Sample1D(int dim) const override;
+			virtual const Point2 Sample2D(int dim) const override;
+		};
+	}
+}
+
+#endif // !_CPPUTIL_BASIC_SAMPLER_PMJ02_SAMPLER_H_
@@ -1,7 +1,8 @@
 #ifndef _BASIC_HEADER_RAND_SET_
 #define _BASIC_HEADER_RAND_SET_
 
-#include <random>
+#include <CppUtil/Basic/Math.h>
+
 #include <vector>
 
 namespace CppUtil {
@@ -17,24 +18,14 @@ namespace CppUtil {
 			RandSet & operator <<(const T & item);
 		protected:
 			std::vector<T> data;
-		private:
-			static std::uniform_int_distribution<unsigned> randMap;
-			static std::default_random_engine randEngine;
 		};
 
-		template <typename T>
-		std::uniform_int_distribution<unsigned> RandSet<T>::randMap;
-
-		template <typename T>
-		std::default_random_engine RandSet<T>::randEngine;
-
-
 		template <typename T>
 		void RandSet<T>::Clear() { data.clear(); }
 
 		template <typename T>
 		T RandSet<T>::RandPick() {
-			size_t idx = randMap(randEngine) % data.size();
+			size_t idx = Math::Rand_UI() % data.size();
 			T rst = data[idx];
 			data[idx] = data.back();
 			data.pop_back();
@@ -43,7 +34,7 @@ namespace CppUtil {
 
 		template <typename T>
 		const T & RandSet<T>::RandLook() {
-			size_t idx = randMap(randEngine) % data.size();
+			size_t idx = Math::Rand_UI() % data.size();
 			return data[idx];
 		}
 
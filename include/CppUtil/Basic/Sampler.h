@@ -0,0 +1,52 @@
+#ifndef _CPPUTIL_BASIC_SAMPLER_SAMPLER_H_
+#define _CPPUTIL_BASIC_SAMPLER_SAMPLER_H_
+
+#include <CppUtil/Basic/HeapObj.h>
+#include <CppUtil/Basic/Math.h>
+#include <CppUtil/Basic/UGM/Point2.h>
+
+#include <cstdint>
+
+namespace CppUtil {
+	namespace Basic {
+		// samples of a pixel, indexed by the sample index and the dimension
+		// the dimensions are taken in order by Get1D and Get2D, one sampler per thread
+		// as the RandSource of Math, two draws in a row are the coordinates of a 2D sample
+		class Sampler : public HeapObj, public Math::RandSource {
+		protected:
+			Sampler(uint32_t seed) : seed(seed), pixel(0, 0), sampleIdx(0), dim(0), hasPendingY(false) { }
+			virtual ~Sampler() = default;
+
+		public:
+			void StartPixelSample(const Point2i & pixel, int sampleIdx, int dim = 0);
+
+			int GetDimension() const { return dim; }
+			void SetDimension(int dim);
+
+			float Get1D();
+			const Point2 Get2D();
+
+			virtual float Next1D() override;
+
+		protected:
+			// dimension dim, and dimensions dim and dim + 1, of the current sample
+			virtual float Sample1D(int dim) const = 0;
+			virtual const Point2 Sample2D(int dim) const = 0;
+
+			// seed for the scrambling of the dimension in the current pixel
+			uint64_t Hash(int dim) const;
+
+		protected:
+			uint32_t seed;
+			Point2i pixel;
+			int sampleIdx;
+
+		private:
+			int dim;
+			float pendingY;
+			bool hasPendingY;
+		};
+	}
+}
+
+#endif // !_CPPUTIL_BASIC_SAMPLER_SAMPLER_H_
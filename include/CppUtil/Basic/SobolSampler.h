@@ -0,0 +1,30 @@
+#ifndef _CPPUTIL_BASIC_SAMPLER_SOBOL_SAMPLER_H_
+#define _CPPUTIL_BASIC_SAMPLER_SOBOL_SAMPLER_H_
+
+#include <CppUtil/Basic/Sampler.h>
+
+namespace CppUtil {
+	namespace Basic {
+		// Owen scrambled Sobol sequence, the same points in every pixel with its own scrambling
+		// dimensions beyond the table start over with a shuffled index
+		class SobolSampler : public Sampler {
+		public:
+			SobolSampler(uint32_t seed = 0) : Sampler(seed) { }
+
+		public:
+			static const Ptr<SobolSampler> New(uint32_t seed = 0) { return Basic::New<SobolSampler>(seed); }
+
+		protected:
+			virtual ~SobolSampler() = default;
+
+		protected:
+			virtual float Sample1D(int dim) const override;
+			virtual const Point2 Sample2D(int dim) const override;
+
+		private:
+			float Value(int dim) const;
+		};
+	}
+}
+
+#endif // !_CPPUTIL_BASIC_SAMPLER_SOBOL_SAMPLER_H_
@@ -3,19 +3,23 @@
 
 #include <CppUtil/Basic/Element.h>
 
+#include <CppUtil/Engine/WideBVHNode.h>
+
 #include <CppUtil/Basic/UGM/BBox.h>
 #include <CppUtil/Basic/UGM/Transform.h>
 
 #include <vector>
 #include <unordered_map>
+#include <string>
+#include <functional>
+#include <cstdint>
 
 namespace CppUtil {
 	namespace Engine {
-		class Shape;
-		class Primitive;
 		class SObj;
-
-		class BVHNode;
+		class Primitive;
+		class CmptGeometry;
+		class TriMesh;
 
 		class BVHAccel : public Basic::Element {
 		public:
@@ -44,16 +48,16 @@ namespace CppUtil {
 					this->axis = axis;
 				}
 
+				void SetBox(const BBoxf & box) { this->box = box; }
+
 			public:
 				const BBoxf & GetBox() const { return box; }
 				bool IsLeaf() const { return shapesNum != 0; }
-				const std::vector<int> ShapesIdx() const {
+				int GetShapesOffset() const {
 					assert(IsLeaf());
-					std::vector<int> rst;
-					for (uint16_t i = 0; i < shapesNum; i++)
-						rst.push_back(shapesOffset + i);
-					return rst;
+					return shapesOffset;
 				}
+				int GetShapesNum() const { return shapesNum; }
 				static int FirstChildIdx(int nodeIdx) { return nodeIdx + 1; }
 				int GetSecondChildIdx() const {
 					assert(!IsLeaf());
@@ -75,37 +79,210 @@ namespace CppUtil {
 				const uint8_t pad[1]{ 0 }; // ensure 32 byte total size
 			};
 
+			using WideNode = WideBVHNode<BVH_WIDTH>;
+			using CompressedWideNode = CompressedWideBVHNode<BVH_WIDTH>;
+
+			// SAH: binned object splits
+			// SBVH: triangles of meshes may also be split into several leaves, the tree overlaps less
+			//       for long thin triangles, at the cost of build time and memory
+			// LBVH: sorted morton codes, builds several times faster than SAH, for interactive previews
+			// HLBVH: LBVH with binned SAH over the top levels
+			enum class BuildMode {
+				SAH,
+				SBVH,
+				LBVH,
+				HLBVH,
+			};
+
+			// binary nodes for the cost, collapsed wide nodes for traversal
+			// used for both the top level over instances and the bottom level over triangles
+			class Tree {
+			public:
+				// split the part of primitive primIdx inside box by the plane axis = pos
+				using ClipFunc = std::function<void(int primIdx, const BBoxf & box, int axis, float pos, BBoxf & left, BBoxf & right)>;
+
+				// primIndices is set to the order of the primitives in the leaves
+				void Build(const std::vector<BBoxf> & boxes, std::vector<int> & primIndices);
+				// SBVH, a primitive may appear in primIndices more than once
+				// the references grow at most by splitBudget * boxes.size()
+				void BuildSpatial(const std::vector<BBoxf> & boxes, const ClipFunc & clip, std::vector<int> & primIndices,
+					float splitBudget = 0.3f);
+				// LBVH, or HLBVH if isHLBVH
+				void BuildLinear(const std::vector<BBoxf> & boxes, std::vector<int> & primIndices, bool isHLBVH);
+				// collapse into compressed wide nodes, about half the memory for a few more node tests
+				// takes effect on the next build, load or refit
+				void SetCompressed(bool isCompressed) { this->isCompressed = isCompressed; }
+
+				// move the leaves to start at multiples of groupSize for SIMD tests of the primitives
+				// primIndices is padded with the first primitive of each leaf
+				void AlignLeaves(int groupSize, std::vector<int> & primIndices);
+
+				// recompute the node boxes bottom up, the topology is kept
+				// boxes are in the order of the leaves
+				void Refit(const std::vector<BBoxf> & boxes);
+				void Clear();
+
+				// binary file of the binary nodes and primIndices, the wide nodes are collapsed again on loading
+				bool Save(const std::string & path, uint64_t hash, const std::vector<int> & primIndices) const;
+				// fail if the file is missing, of another hash or inconsistent
+				bool Load(const std::string & path, uint64_t hash, int primNum, std::vector<int> & primIndices);
+
+			public:
+				bool IsEmpty() const { return GetWideNodeNum() == 0; }
+				const BBoxf GetBox() const { return linearBVHNodes.empty() ? BBoxf() : linearBVHNodes[0].GetBox(); }
+
+				int GetBVHNodeNum() const { return static_cast<int>(linearBVHNodes.size()); }
+				const LinearBVHNode & GetBVHNode(int idx) const {
+					assert(idx >= 0 && idx < linearBVHNodes.size());
+					return linearBVHNodes[idx];
+				}
+				// root is at 0, traversal uses the collapsed wide nodes
+				// either the full precision or the compressed ones are there
+				bool IsCompressed() const { return !compressedNodes.empty(); }
+				int GetWideNodeNum() const { return static_cast<int>(IsCompressed() ? compressedNodes.size() : wideNodes.size()); }
+				const WideNode * GetWideNodes() const { return wideNodes.data(); }
+				const CompressedWideNode * GetCompressedNodes() const { return compressedNodes.data(); }
+
+				// SAH cost of the tree, relative to the surface area of the root
+				float GetSAHCost() const;
+
+			private:
+				// rebuild the wide nodes from linearBVHNodes
+				void Collapse();
+
+				// collapse the binary subtree at linearBVHNodes[nodeIdx] into nodes, return the wide node index
+				template<typename NodeT>
+				int CollapseBVH(int nodeIdx, std::vector<NodeT> & nodes);
+
+			private:
+				std::vector<LinearBVHNode> linearBVHNodes;
+				std::vector<WideNode> wideNodes;
+				std::vector<CompressedWideNode> compressedNodes;
+				bool isCompressed{ false };
+			};
+
+			// triangles in SoA form, tested at once with SSE
+			struct alignas(16) TriangleGroup {
+				static constexpr int size = 4;
+
+				float p1[3][size]; // [axis][triangle]
+				float e1[3][size]; // p2 - p1
+				float e2[3][size]; // p3 - p1
+			};
+
+			// bottom level, triangles of a mesh in its local space, shared by all instances of the mesh
+			struct MeshBVH {
+				Basic::WPtr<TriMesh> mesh; // the cache entry is valid while the mesh is alive
+				uint64_t hash; // of the mesh content, names the disk cache file
+				BuildMode buildMode;
+				bool isCompressed;
+				Tree tree;
+				// leaves are aligned to TriangleGroup::size, see Tree::AlignLeaves
+				std::vector<int> indice; // 3 per triangle, in the order of the leaves
+				std::vector<TriangleGroup> triGroups; // indice in groups, with pre-gathered edges
+			};
+
+			// type tag of an instance, the intersectors switch on it
+			enum class PrimType : uint8_t {
+				TriMesh,
+				Sphere,
+				Plane,
+				Disk,
+				Capsule,
+			};
+
+			// one per CmptGeometry, leaves of the top level
+			struct Instance {
+				Basic::Transform worldToLocal;
+				Basic::Transform localToWorld; // also transforms normals to world space
+				Basic::Ptr<SObj> sobj;
+				PrimType type;
+				float halfHeight; // capsule
+				Basic::Ptr<TriMesh> mesh; // TriMesh only
+				Basic::Ptr<const MeshBVH> meshBVH; // TriMesh only
+
+				// to detect changes in Update
+				BBoxf localBox;
+				BBoxf primitiveBox; // GetBBox of the primitive, halfHeight is also compared
+				Basic::WPtr<CmptGeometry> geometry;
+				const Primitive * primitive;
+			};
+
 		public:
+			// bottom levels of meshes seen before are reused, so rebuilding after a move is cheap
 			void Init(Basic::Ptr<SObj> root);
+			// if only transforms changed, refit the top level in O(nodes)
+			// otherwise, or if the SAH cost grows too much, fall back to Init
+			void Update(Basic::Ptr<SObj> root);
+			// keeps the bottom level cache
 			void Clear();
 
+			// mesh trees are loaded from and saved to this directory, keyed by the hash of the content
+			// empty disables the disk cache
+			void SetCacheDir(const std::string & dir) { cacheDir = dir; }
+
+			// the next Init or Update rebuilds the trees if the mode changes
+			void SetBuildMode(BuildMode mode);
+			BuildMode GetBuildMode() const { return buildMode; }
+
+			// quantized wide nodes for large scenes, see Tree::SetCompressed
+			// the next Init or Update rebuilds the trees if it changes
+			void SetCompressed(bool isCompressed);
+			bool IsCompressed() const { return isCompressed; }
+
 		public:
-			const Basic::Transform & GetShapeW2LMat(Basic::Ptr<Shape> shape) const;
-			const Basic::Ptr<SObj> GetSObj(Basic::Ptr<Shape> shape) const;
+			const Tree & GetTLAS() const { return tlas; }
 
-			const LinearBVHNode & GetBVHNode(int idx) const {
-				assert(idx >= 0 && idx < linearBVHNodes.size());
-				return linearBVHNodes[idx];
-			}
-			const Basic::Ptr<Shape> GetShape(int idx) const {
-				assert(idx >= 0 && idx < shapes.size());
-				return shapes[idx];
+			// in the order of the top level leaves
+			int GetInstanceNum() const { return static_cast<int>(instances.size()); }
+			const Instance & GetInstance(int idx) const {
+				assert(idx >= 0 && idx < instances.size());
+				return instances[idx];
 			}
 
-		private:
-			void LinearizeBVH(Basic::Ptr<BVHNode> bvhNode);
+			// seconds of the last build
+			double GetBuildTime() const { return buildTime; }
+			// trees the last Init loaded from the disk cache
+			int GetLoadedTreeNum() const { return loadedTreeNum; }
+			// SAH cost of the top level
+			float GetSAHCost() const { return tlas.GetSAHCost(); }
 
 		private:
-			// triangle Ҫͨ mesh ȡ matrix
-			std::unordered_map<Basic::Ptr<Primitive>, Basic::Transform> worldToLocalMatrixes;
-			std::unordered_map<Basic::Ptr<Primitive>, Basic::Ptr<SObj>> primitive2sobj;
+			// build or fetch from the cache
+			const Basic::Ptr<const MeshBVH> GetMeshBVH(Basic::Ptr<TriMesh> mesh);
+
+			// load the tree from the disk cache, or build it and save it there
+			// an empty name builds it without the cache
+			// SBVH splits spatially if clip is not null
+			void BuildTree(Tree & tree, const std::vector<BBoxf> & boxes, std::vector<int> & primIndices,
+				const std::string & name, uint64_t hash, const Tree::ClipFunc & clip = nullptr);
+
+			// return false if the geometries of the scene are not the ones of the instances
+			bool UpdateTransforms(const std::vector<Basic::Ptr<CmptGeometry>> & geos, bool & isChanged);
 
-			// shapes and box
+		private:
 			class BVHInitVisitor;
 			friend class BVHInitVisitor;
-			std::vector<Basic::Ptr<Shape>> shapes;
 
-			std::vector<LinearBVHNode> linearBVHNodes;
+			std::vector<Instance> instances;
+			Tree tlas;
+
+			// bottom levels by mesh identity
+			std::unordered_map<const TriMesh *, Basic::Ptr<const MeshBVH>> meshBVHs;
+			int builtMeshBVHNum{ 0 };
+
+			BuildMode buildMode{ BuildMode::SAH };
+			bool isCompressed{ false };
+			std::string cacheDir;
+			int loadedTreeNum{ 0 };
+
+			// num of the CmptGeometry with a primitive in the last Init
+			size_t geometryNum{ 0 };
+			// rebuild when refitting makes the cost this much larger than the built one
+			static constexpr float maxRefitCostRatio = 1.5f;
+			float builtSAHCost{ 0 };
+
+			double buildTime{ 0 };
 		};
 	}
 }
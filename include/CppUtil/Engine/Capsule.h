@@ -18,7 +18,8 @@ namespace CppUtil {
 
 		public:
 			virtual const BBoxf GetBBox() const override {
-				return BBoxf({ -1, -2, -1 }, { 1, 2, 1 });
+				const float halfHeight = height / 2;
+				return BBoxf({ -1, -1 - halfHeight, -1 }, { 1, 1 + halfHeight, 1 });
 			}
 
 		public:
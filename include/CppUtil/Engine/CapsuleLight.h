@@ -38,6 +38,16 @@ namespace CppUtil {
 
 			virtual bool IsDelta() const override { return false; }
 
+			virtual bool GetBounds(BBoxf & box, Normalf & axis, float & cosTheta_o, float & cosTheta_e, float & power) const override;
+
+		private:
+			// probabilities to sample the side, the upper cap and the lower cap from p, by their rough solid angles
+			// false if p is inside the capsule
+			bool ComponentP(const Point3 & p, float & pSide, float & pUpper, float & pLower) const;
+
+			// area of the side facing p, p is out of the infinite cylinder
+			float SideAreaFacing(const Point3 & p) const;
+
 		public:
 			RGBf color;
 			float intensity;
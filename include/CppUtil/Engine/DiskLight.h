@@ -39,6 +39,8 @@ namespace CppUtil {
 
 			virtual bool IsDelta() const override { return false; }
 
+			virtual bool GetBounds(BBoxf & box, Normalf & axis, float & cosTheta_o, float & cosTheta_e, float & power) const override;
+
 		public:
 			RGBf color;
 			float intensity;
@@ -4,20 +4,43 @@
 #include <CppUtil/Basic/HeapObj.h>
 #include <CppUtil/Basic/UGM/Point2.h>
 
+#include <cmath>
+
 namespace CppUtil {
 	namespace Engine {
+		// filters are separable, the weight of p is Evaluate1D(p.x, 0) * Evaluate1D(p.y, 1)
+		// Evaluate1D is baked into a table of each axis, so that splatting a sample costs no virtual calls
 		class Filter : public Basic::HeapObj {
 		protected:
 			Filter(const Vec2 & radius) :
 				radius(radius), invRadius(1.0f / radius.x, 1.0f / radius.y) { }
 			virtual ~Filter() = default;
 
+			// must be called at the end of the constructors of the subclasses
+			void InitTable();
+
 		public:
-			virtual float Evaluate(const Point2f & p) const = 0;
+			static constexpr int TABLE_SIZE = 64;
+
+			// x in [-radius[axis], radius[axis]]
+			virtual float Evaluate1D(float x, int axis) const = 0;
+
+			float Evaluate(const Point2f & p) const {
+				return Evaluate1D(p.x, 0) * Evaluate1D(p.y, 1);
+			}
+
+			// Evaluate1D at the center of the bin of x, 0 outside the radius
+			float LookUp1D(float x, int axis) const {
+				const int idx = static_cast<int>(std::abs(x) * invRadius[axis] * TABLE_SIZE);
+				return idx < TABLE_SIZE ? table[axis][idx] : 0.f;
+			}
 
 		public:
 			const Vec2 radius;
 			const Vec2 invRadius;
+
+		private:
+			float table[2][TABLE_SIZE];
 		};
 	}
 }
@@ -7,18 +7,18 @@ namespace CppUtil {
 	namespace Engine {
 		class FilterBox : public Filter {
 		public:
-			FilterBox(const Vec2 & radius) : Filter(radius) { }
+			FilterBox(const Vec2 & radius) : Filter(radius) { InitTable(); }
 
 		protected:
 			virtual ~FilterBox() = default;
 
 		public:
-			const Basic::Ptr<FilterBox> New(const Vec2 & radius) {
+			static const Basic::Ptr<FilterBox> New(const Vec2 & radius) {
 				return Basic::New<FilterBox>(radius);
 			}
 
 		public:
-			virtual float Evaluate(const Point2f & p) const override {
+			virtual float Evaluate1D(float x, int axis) const override {
 				return 1;
 			}
 		};
@@ -10,19 +10,19 @@ namespace CppUtil {
 			FilterGaussian(const Vec2 & radius, float alpha)
 				: Filter(radius), alpha(alpha),
 				expX(std::exp(-alpha * radius.x*radius.x)),
-				expY(std::exp(-alpha * radius.y*radius.y)) { }
+				expY(std::exp(-alpha * radius.y*radius.y)) { InitTable(); }
 
 		protected:
 			virtual ~FilterGaussian() = default;
 
 		public:
-			const Basic::Ptr<FilterGaussian> New(const Vec2 & radius, float alpha) {
+			static const Basic::Ptr<FilterGaussian> New(const Vec2 & radius, float alpha) {
 				return Basic::New<FilterGaussian>(radius, alpha);
 			}
 
 		public:
-			virtual float Evaluate(const Point2f & p) const override {
-				return Gaussian(p.x, expX) * Gaussian(p.y, expY);
+			virtual float Evaluate1D(float x, int axis) const override {
+				return Gaussian(x, axis == 0 ? expX : expY);
 			}
 
 		private:
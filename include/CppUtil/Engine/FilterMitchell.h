@@ -7,7 +7,7 @@ namespace CppUtil {
 	namespace Engine {
 		class FilterMitchell : public Filter {
 		public:
-			FilterMitchell(const Vec2 & radius, float B, float C) : Filter(radius), B(B), C(C) { }
+			FilterMitchell(const Vec2 & radius, float B, float C) : Filter(radius), B(B), C(C) { InitTable(); }
 
 		protected:
 			virtual ~FilterMitchell() = default;
@@ -18,8 +18,8 @@ namespace CppUtil {
 			}
 
 		public:
-			virtual float Evaluate(const Point2f & p) const override {
-				return Mitchell1D(p.x * invRadius.x) * Mitchell1D(p.y * invRadius.y);
+			virtual float Evaluate1D(float x, int axis) const override {
+				return Mitchell1D(x * invRadius[axis]);
 			}
 
 		private:
@@ -7,19 +7,19 @@ namespace CppUtil {
 	namespace Engine {
 		class FilterSinc : public Filter {
 		public:
-			FilterSinc(const Vec2 & radius, float tau) : Filter(radius), tau(tau) { }
+			FilterSinc(const Vec2 & radius, float tau) : Filter(radius), tau(tau) { InitTable(); }
 
 		protected:
 			virtual ~FilterSinc() = default;
 
 		public:
-			const Basic::Ptr<FilterSinc> New(const Vec2 & radius, float tau) {
+			static const Basic::Ptr<FilterSinc> New(const Vec2 & radius, float tau) {
 				return Basic::New<FilterSinc>(radius, tau);
 			}
 
 		public:
-			virtual float Evaluate(const Point2f & p) const override {
-				return WindowSinc(p.x, radius.x) * WindowSinc(p.y, radius.y);
+			virtual float Evaluate1D(float x, int axis) const override {
+				return WindowSinc(x, radius[axis]);
 			}
 
 		private:
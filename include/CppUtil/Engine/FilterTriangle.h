@@ -7,20 +7,19 @@ namespace CppUtil {
 	namespace Engine {
 		class FilterTriangle : public Filter {
 		public:
-			FilterTriangle(const Vec2 & radius) : Filter(radius) { }
+			FilterTriangle(const Vec2 & radius) : Filter(radius) { InitTable(); }
 
 		protected:
 			virtual ~FilterTriangle() = default;
 
 		public:
-			const Basic::Ptr<FilterTriangle> New(const Vec2 & radius) {
+			static const Basic::Ptr<FilterTriangle> New(const Vec2 & radius) {
 				return Basic::New<FilterTriangle>(radius);
 			}
 
 		public:
-			virtual float Evaluate(const Point2f & p) const override {
-				const auto delta = (radius - Vec2(p.Abs())).MaxWith({ 0,0 });
-				return delta.x * delta.y;
+			virtual float Evaluate1D(float x, int axis) const override {
+				return std::max(0.f, radius[axis] - std::abs(x));
 			}
 		};
 	}
@@ -2,7 +2,7 @@
 #define _CPPUTIL_ENGINE_INFINITE_AREA_LIGHT_H_
 
 #include <CppUtil/Engine/Light.h>
-#include <CppUtil/Basic/AliasMethod.h>
+#include <CppUtil/Basic/Distribution2D.h>
 
 namespace CppUtil {
 	namespace Basic {
@@ -51,7 +51,8 @@ namespace CppUtil {
 
 		private:
 			Basic::Ptr<Basic::Image> img;
-			Basic::AliasMethod aliasMethod;
+			// over the texcoords, by the illumination of the pixels and the sin(theta) of their rows
+			Basic::Distribution2D distribution;
 		};
 	}
 }
@@ -9,6 +9,7 @@
 #include <CppUtil/Basic/UGM/Point3.h>
 #include <CppUtil/Basic/UGM/Vector3.h>
 #include <CppUtil/Basic/UGM/Normal.h>
+#include <CppUtil/Basic/UGM/BBox.h>
 
 namespace CppUtil {
 	namespace Engine {
@@ -34,6 +35,14 @@ namespace CppUtil {
 
 			// Щûлκߵ
 			virtual const RGBf Le(const ERay & ray) const { return RGBf(0.f); }
+
+			// bounds of the light in its space, for the light BVH
+			// false for lights without bounds, like those at infinity
+			// @arg0 out, box of the emitter
+			// @arg1, arg2 out, the normals of the emitter are within acos(cosTheta_o) of axis
+			// @arg3 out, light leaves the emitter within acos(cosTheta_e) of its normal
+			// @arg4 out, radiant power
+			virtual bool GetBounds(BBoxf & box, Normalf & axis, float & cosTheta_o, float & cosTheta_e, float & power) const { return false; }
 		};
 	}
 }
@@ -0,0 +1,119 @@
+#ifndef _ENGINE_LIGHT_LIGHT_SAMPLER_H_
+#define _ENGINE_LIGHT_LIGHT_SAMPLER_H_
+
+#include <CppUtil/Basic/HeapObj.h>
+#include <CppUtil/Basic/AliasMethod.h>
+
+#include <CppUtil/Basic/UGM/Transform.h>
+#include <CppUtil/Basic/UGM/BBox.h>
+
+#include <vector>
+#include <cstdint>
+
+namespace CppUtil {
+	namespace Engine {
+		class Light;
+
+		// picks the light of a light sample at a shading point
+		// lights without bounds take an equal share with all the bounded ones together,
+		// which are picked uniformly, by their power, or by their importance at the point from a light BVH
+		// the BVH also bounds the lights a direction can reach, so the densities of a direction over all the lights are output sensitive
+		// light IDs are the indices of the lights given to Init
+		class LightSampler : public Basic::HeapObj {
+		public:
+			enum class Mode {
+				Uniform, // every light alike, bounded or not
+				Power,
+				BVH,
+			};
+
+		public:
+			LightSampler(Mode mode = Mode::BVH) : mode(mode) { }
+
+		public:
+			static const Basic::Ptr<LightSampler> New(Mode mode = Mode::BVH) {
+				return Basic::New<LightSampler>(mode);
+			}
+
+		protected:
+			virtual ~LightSampler() = default;
+
+		public:
+			Mode GetMode() const { return mode; }
+			// takes effect at the next Init
+			void SetMode(Mode mode) { this->mode = mode; }
+
+			// lightToWorldVec must not scale
+			void Init(const std::vector<Basic::Ptr<Light>> & lights,
+				const std::vector<Transform> & lightToWorldVec,
+				const std::vector<Transform> & worldToLightVec);
+
+		public:
+			// @arg0 in, shading point in world space
+			// @arg1 in, u in [0, 1)
+			// @arg2 out, probability of the light
+			// @return light ID, -1 if no light reaches p
+			int Sample(const Point3 & p, float u, float & pmf) const;
+
+			// probability that Sample picks lightID at p
+			float PMF(const Point3 & p, int lightID) const;
+
+			// sum of the densities of the direction dir (in world space, unit) at p over the lights but skipLightID
+			// each weighted by the probability of its light, or by 1 if isWeighted is false
+			// delta lights have no density
+			float PDF(const Point3 & p, const Normalf & dir, int skipLightID = -1, bool isWeighted = true) const;
+
+		private:
+			// bounds of a light or a node in world space
+			struct LightBounds {
+				BBoxf box;
+				Vec3 axis;
+				float cosTheta_o;
+				float cosTheta_e;
+				float power;
+
+				const LightBounds Union(const LightBounds & rhs) const;
+
+				// bound of the contribution to p, from the power, distance and orientation
+				// Conty Estevez and Kulla, Importance Sampling of Many Lights with Adaptive Tree Splitting, 2018
+				float Importance(const Point3 & p) const;
+			};
+
+			struct Node {
+				LightBounds bounds;
+				int secondChild; // interior, the first child is the next node
+				int lightID; // leaf, -1 for interior nodes
+			};
+
+			// nodes of the lights in boundedLights[first, first + num), median split on the widest axis of the centers
+			// bitTrail: the path from the root, bit i is 1 if the node at depth i is a second child
+			int Build(std::vector<int> & boundedLights, std::vector<LightBounds> & lightBounds, int first, int num, int depth, uint64_t bitTrail);
+
+			// probability of picking a bounded light at all
+			float BoundedP() const;
+
+			// probability to go from the node to its children at p, false if no light of node reaches p
+			bool ChildrenP(const Point3 & p, int nodeIdx, float & p0, float & p1) const;
+
+			float LightPDF(int lightID, const Point3 & p, const Normalf & dir) const;
+
+		private:
+			Mode mode;
+
+			std::vector<Basic::Ptr<Light>> lights;
+			std::vector<Transform> worldToLightVec;
+
+			std::vector<int> unboundedLights;
+			std::vector<bool> isBounded;
+			std::vector<Node> nodes;
+			std::vector<uint64_t> lightToBitTrail;
+
+			// power mode, probability of each bounded light among the bounded ones
+			Basic::AliasMethod powerTable;
+			std::vector<int> powerTableLights;
+			std::vector<int> lightToPowerTableIdx;
+		};
+	}
+}
+
+#endif//!_ENGINE_LIGHT_LIGHT_SAMPLER_H_
@@ -2,6 +2,8 @@
 #define _ENGINE_RTX_PATH_TRACER_H_
 
 #include <CppUtil/Engine/RayTracer.h>
+#include <CppUtil/Engine/RayIntersector.h>
+#include <CppUtil/Engine/LightSampler.h>
 
 #include <CppUtil/Basic/UGM/Transform.h>
 #include <CppUtil/Basic/UGM/Mat3x3.h>
@@ -14,7 +16,6 @@ namespace CppUtil {
 		class Light;
 		class BVHAccel;
 
-		class RayIntersector;
 		class VisibilityChecker;
 
 		class BSDF;
@@ -33,40 +34,102 @@ namespace CppUtil {
 		public:
 			virtual const RGBf Trace(Ray & ray) { return Trace(ray, 0, RGBf(1.f)); }
 
+			// camera rays and their light samples are tested as packets, the rest of the paths ray by ray
+			virtual void Trace(Ray * rays, const Point2i * pixels, int sampleIdx, int num, RGBf * radiances) override;
+
 			virtual void Init(Basic::Ptr<Scene> scene, Basic::Ptr<BVHAccel> bvhAccel) override;
 
 		protected:
 			// ray ϵ
+			// bounces in a loop, the same sums as a recursion over the depth
 			const RGBf Trace(Ray & ray, int depth, RGBf pathThroughput);
 
-		private:
+			// rays[0, num), num <= RAY_PACKET_SIZE
+			void TracePacket(Ray * rays, const Point2i * pixels, int sampleIdx, int num, RGBf * radiances);
+
+		protected:
+			// dimensions of a pixel sample of each bounce, the light sample takes them from 0, the next ray from BSDF_SAMPLE_DIM
+			// a stage starts at its own dimension however many the stages before took
+			static constexpr int BOUNCE_SAMPLE_DIMS = 16;
+			static constexpr int LIGHT_SAMPLE_DIM = 0;
+			static constexpr int BSDF_SAMPLE_DIM = 8;
+
+			void StartSampleStage(int depth, int stageDim) const {
+				if (sampler)
+					sampler->SetDimension(CAMERA_SAMPLE_DIMS + depth * BOUNCE_SAMPLE_DIMS + stageDim);
+			}
+
 			enum SampleLightMode {
 				ALL,
 				RandomOne,
 			};
 
+			// surface at the end of a ray
+			// bsdf is not owned, materials are kept by the scene
+			struct SurfaceHit {
+				BSDF * bsdf;
+				Point3 pos;
+				Mat3f surfaceToWorld;
+				Mat3f worldToSurface;
+				Normalf w_out;
+				Point2 texcoord;
+			};
+
+			// emission of the hit, or the lights seen by the ray if it hits nothing
+			// hit.bsdf is nullptr if the path ends here
+			const RGBf BeginShade(const Ray & ray, const RayIntersector::Rst & rst, int depth, SurfaceHit & hit) const;
+
+			bool IsOccluded(const Ray & shadowRay) const;
+
 			const RGBf SampleLight(
 				const Point3 & posInWorldSpace,
 				const Mat3f & worldToSurface,
-				Basic::Ptr<BSDF> bsdf,
+				BSDF * bsdf,
 				const Normalf & w_out,
 				const Point2 & texcoord,
 				SampleLightMode mode
 			) const;
 
+			// light of a light picked by lightSampler before the test of shadowRay
+			const RGBf SampleRandomLight(
+				const Point3 & posInWorldSpace,
+				const Mat3f & worldToSurface,
+				BSDF * bsdf,
+				const Normalf & w_out,
+				const Point2 & texcoord,
+				Ray & shadowRay
+			) const;
+
 			const RGBf SampleLightImpl(
 				int lightID,
 				const Point3 & posInWorldSpace,
 				const Point3 & posInLightSpace,
 				const Mat3f & worldToSurface,
-				Basic::Ptr<BSDF> bsdf,
+				BSDF * bsdf,
 				const Normalf & w_out,
 				const Point2 & texcoord,
-				float factorPD
+				SampleLightMode mode,
+				float factorPD,
+				Ray & shadowRay
+			) const;
+
+			// the next ray of the path at hitPos, false if the path ends here
+			// weight is the factor of the radiance along matRay, Russian roulette included
+			bool SampleNextRay(
+				BSDF * bsdf,
+				SampleLightMode mode,
+				const Normalf & w_out,
+				const Mat3f & surfaceToWorld,
+				const Point2 & texcoord,
+				const Point3 & hitPos,
+				int depth,
+				const RGBf & pathThroughput,
+				Ray & matRay,
+				RGBf & weight
 			) const;
 
 			const RGBf SampleBSDF(
-				Basic::Ptr<BSDF> bsdf,
+				BSDF * bsdf,
 				SampleLightMode mode,
 				const Normalf & w_out,
 				const Mat3f & surfaceToWorld,
@@ -79,12 +142,35 @@ namespace CppUtil {
 		public:
 			int maxDepth;
 
+			// how the light of a light sample is picked, takes effect at the next Init
+			LightSampler::Mode lightSampleMode;
+
 		private:
+			// terms of a bounce, the radiance of the path is summed back to front
+			struct PathVertex {
+				RGBf emitL; // emission, or the lights seen by an escaped ray
+				RGBf lightL; // light sample
+				RGBf weight; // factor of the radiance of the next vertex, 0 for the last one
+				bool hasSurface;
+			};
+
+			// state of the bounce loop of Trace, allocated once
+			struct PathState {
+				Ray ray;
+				RGBf pathThroughput;
+				SurfaceHit hit;
+				std::vector<PathVertex> vertices;
+			};
+
+			PathState pathState;
+
+		protected:
 			std::vector<Basic::Ptr<Light>> lights;
 			std::map<Basic::Ptr<Light>, int> lightToIdx;
 			std::vector<Transform> worldToLightVec;
 			std::vector<Transform> lightToWorldVec;
 
+			Basic::Ptr<LightSampler> lightSampler;
 			Basic::Ptr<RayIntersector> rayIntersector;
 			Basic::Ptr<VisibilityChecker> visibilityChecker;
 		};
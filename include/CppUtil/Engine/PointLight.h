@@ -36,6 +36,8 @@ namespace CppUtil {
 
 			virtual bool IsDelta() const override { return true; }
 
+			virtual bool GetBounds(BBoxf & box, Normalf & axis, float & cosTheta_o, float & cosTheta_e, float & power) const override;
+
 		private:
 			static float Fwin(float d, float radius);
 
@@ -7,7 +7,12 @@
 
 #include <functional>
 #include <vector>
+#include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <chrono>
 
 namespace CppUtil {
 	namespace Basic {
@@ -33,58 +38,150 @@ namespace CppUtil {
 
 		public:
 			void Run(Basic::Ptr<Scene> scene, Basic::Ptr<Basic::Image> img);
+			// the passes in flight are finished and the tiles behind get one more pass,
+			// so that the tiles which are not converged end with the same samples per pixel
 			void Stop();
 			RendererState GetState() const { return state; }
 			float ProgressRate();
 
+			// seconds until the run is complete, from the measured time of the passes of each tile
+			// negative if no pass is done yet
+			double EstimateRemainingTime();
+
+			// directory of the BVH disk cache, empty disables it
+			void SetBVHCacheDir(const std::string & dir);
+			const Basic::Ptr<BVHAccel> GetBVHAccel() const { return bvhAccel; }
+
 		public:
+			// samples per pixel of a tile, unless adaptive sampling stops it earlier
+			// the passes saved on converged tiles go to noisy ones, up to 4 * maxLoop of a tile
 			volatile int maxLoop;
 
+			// a tile stops getting samples once its error is below errorThreshold
+			// and it has minLoop samples per pixel at least, 0 disables adaptive sampling
+			volatile float errorThreshold;
+			volatile int minLoop;
+
+			// seconds of wall clock time of a run, 0 for no limit
+			// with a budget, rounds of passes over the tiles go on while the next one is estimated to end within it,
+			// or until all the tiles converge, maxLoop is ignored
+			volatile double timeBudget;
+
+			// width and height of the tiles in pixels, the tiles at the right and bottom borders may be smaller
+			volatile int tileSize;
+
+			// samples per pixel of each tile so far, in raster order
+			const std::vector<int> GetTileSampleNums() { return tileTask.GetSampleNums(); }
+
 		private:
+			// passes over the tiles in rounds, the converged ones skipped
+			// a round visits the tiles along a Hilbert curve, so the workers render neighbouring tiles at the same time
+			// and share the nodes of the BVH and the texels they touch
+			// workers take the tiles by an atomic counter without locks, a tile is given to one worker at a time
 			class TileTask {
 			public:
-				void Init(int tileNum, int maxLoop) {
-					this->tileNum = tileNum;
-					this->maxLoop = maxLoop;
-					curTile = 0;
-					curLoop = 0;
-				}
+				// tiles of tileCols x tileRows in raster order, rendered by workerNum workers
+				// maxPassNum passes in all, at most maxSampleNum of a tile
+				// timeBudget in seconds from now, 0 for no limit,
+				// a round over the tiles is only started if it is estimated to end within it
+				// must not be called while workers are running, the queries below may run meanwhile
+				void Init(int tileCols, int tileRows, int maxPassNum, int maxSampleNum, int workerNum, double timeBudget);
 
 			public:
 				struct Task {
-					Task(bool hasTask, int tileID = -1, int curLoop = -1)
-						: hasTask(hasTask), tileID(tileID), curLoop(curLoop) { }
+					Task(bool hasTask, int tileID = -1, int sampleIdx = -1)
+						: hasTask(hasTask), tileID(tileID), sampleIdx(sampleIdx) { }
 
 					bool hasTask;
 					int tileID;
-					int curLoop;
+					int sampleIdx; // samples of the tile before this pass
 				};
-				const Task GetTask() {
-					if (curLoop == maxLoop)
-						return Task(false);
-
-					m.lock();
-					auto rst = Task(true, curTile, curLoop);
-					curTile++;
-					if (curTile == tileNum) {
-						curTile = 0;
-						curLoop += 1;
-					}
-					m.unlock();
-
-					return rst;
-				}
-
-				int GetCurLoop() const {
-					return curLoop;
-				}
+
+				// GetTask, Done and Finish are only called by the workers of a run,
+				// they take no lock but to put idle workers to sleep and wake them
+
+				// waits if all unconverged tiles are taken by other workers, until one of them is done
+				const Task GetTask();
+
+				// the pass of the task is merged into the film, it took seconds
+				void Done(const Task & task, bool isConverged, double seconds);
+
+				// no more passes but those which bring the tiles up to the most sampled one
+				void Finish();
+				bool IsFinishing() const { return isFinishing; }
+
+			public:
+				// the queries are safe from other threads at any time, also while Init runs
+				// they see the tiles of the last Init, none before the first one
+
+				// passes issued of the budget, or the time spent of the time budget
+				float GetProgress() const;
+
+				// seconds until the run is complete, negative if no pass is done yet
+				double EstimateRemainingTime() const;
+
+				const std::vector<int> GetSampleNums() const;
 
 			private:
-				int tileNum;
-				int curTile;
-				int maxLoop;
-				int curLoop;
-				std::mutex m;
+				// tiles of the Hilbert curve of the smallest power of 2 square over the grid
+				static const std::vector<int> HilbertOrder(int tileCols, int tileRows);
+
+				// samples a tile may have now
+				int SampleNumLimit() const;
+
+				// some tile is not converged and below the limit, it may be busy
+				bool HasWork() const;
+
+				int MaxUnconvergedSampleNum() const;
+
+				double GetElapsedTime() const;
+
+				// passes and their seconds to bring the unconverged tiles up to sampleNum,
+				// each tile from its own mean time of a pass, false if no pass is done yet
+				bool EstimatePasses(int sampleNum, double & passNumSum, double & passTimeSum) const;
+
+				// seconds for the workers to bring the unconverged tiles up to sampleNum, negative if no pass is done yet
+				double EstimateTime(int sampleNum) const;
+
+				// a new round over the tiles is estimated to end within the time budget
+				bool IsRoundInBudget() const;
+
+				// wake the idle workers to look for tiles again
+				void Notify();
+
+			private:
+				// sampleNum, doneNum and passTimeSum are only written by the worker which holds the tile
+				struct Tile {
+					std::atomic<int> sampleNum; // passes issued
+					std::atomic<int> doneNum;
+					std::atomic<double> passTimeSum;
+					std::atomic<bool> isBusy;
+					std::atomic<bool> isConverged;
+				};
+
+				int tileNum{ 0 };
+				int maxSampleNum{ 0 };
+				int maxPassNum{ 0 };
+				int workerNum{ 1 };
+				double timeBudget{ 0.0 };
+				std::chrono::steady_clock::time_point startTime;
+				std::vector<int> order; // tile IDs along the Hilbert curve
+				std::unique_ptr<Tile[]> tiles;
+				std::atomic<unsigned> nextTask{ 0 }; // index into order, modulo tileNum
+				std::atomic<int> passNum{ 0 }; // passes issued
+				std::atomic<int> roundSampleNum{ 0 }; // the most passes issued of a tile, a pass above starts a round
+				std::atomic<bool> isFinishCalled{ false };
+				std::atomic<bool> isFinishing{ false };
+				std::atomic<int> finishSampleNum{ 0 };
+
+				// Init swaps the tiles of a run in while the queries read them
+				mutable std::mutex stateLock;
+
+				// idle workers wait for a change of eventNum, which Done and Finish raise
+				std::mutex idleLock;
+				std::condition_variable idleCondition;
+				std::atomic<int> idleWorkerNum{ 0 };
+				std::atomic<unsigned> eventNum{ 0 };
 			};
 
 		private:
@@ -15,6 +15,9 @@ namespace CppUtil {
 	}
 
 	namespace Engine {
+		// max number of rays traced together by the packet queries
+		constexpr int RAY_PACKET_SIZE = 16;
+
 		// ѰĽ
 		class RayIntersector final : public Intersector {
 		public:
@@ -26,13 +29,14 @@ namespace CppUtil {
 					return closestSObj != nullptr;
 				}
 
-				Basic::Ptr<SObj> closestSObj;
+				// raw pointer, so that tracing does not touch the reference count
+				SObj * closestSObj{ nullptr };
 				Normalf n;
 				Point2 texcoord;
 				Normalf tangent;
 			private:
 				friend class RayIntersector;
-				bool isIntersect;
+				bool isIntersect{ false };
 			};
 
 		public:
@@ -49,6 +53,16 @@ namespace CppUtil {
 		public:
 			const Rst & GetRst() { return rst; }
 
+			// same as bvhAccel->Accept(This()), without the dispatch of Visitor
+			// makes no heap allocation
+			void Intersect(const BVHAccel & bvhAccel);
+
+			// closest hits of rays[0, num) at once, num <= RAY_PACKET_SIZE
+			// coherent rays share the traversal, diverged ones fall back to single rays
+			// the tMax of a hit ray is shortened to the hit, rsts[i] is the Rst of rays[i]
+			// makes no heap allocation
+			void IntersectPacket(const BVHAccel & bvhAccel, Ray * rays, int num, Rst * rsts);
+
 		private:
 			//  rstཻ޸ ray.tMax
 			void Visit(Basic::Ptr<BVHAccel> bvhAccel);
@@ -60,9 +74,6 @@ namespace CppUtil {
 			void Visit(Basic::Ptr<Disk> disk);
 			void Visit(Basic::Ptr<Capsule> capsule);
 
-		private:
-			bool Intersect(const BBoxf & bbox, const Val3f & invDir) const;
-
 		private:
 			Ray * ray;
 			Rst rst;
@@ -5,7 +5,11 @@
 
 #include <CppUtil/Engine/Ray.h>
 
+#include <CppUtil/Basic/Sampler.h>
+#include <CppUtil/Basic/Math.h>
+
 #include <CppUtil/Basic/UGM/RGB.h>
+#include <CppUtil/Basic/UGM/Point2.h>
 
 namespace CppUtil {
 	namespace Engine {
@@ -20,12 +24,43 @@ namespace CppUtil {
 		public:
 			// ray ϵ
 			virtual const RGBf Trace(Ray & ray) = 0;
+
+			// rays[0, num) of a tile, every RAY_PACKET_SIZE rays in a row are of nearby pixels
+			// ray i is the sample sampleIdx of pixels[i]
+			// tracers may share the work of coherent rays, by default they are traced one by one
+			virtual void Trace(Ray * rays, const Point2i * pixels, int sampleIdx, int num, RGBf * radiances) {
+				for (int i = 0; i < num; i++) {
+					StartPixelSample(pixels[i], sampleIdx);
+					radiances[i] = Trace(rays[i]);
+				}
+			}
+
+			// randoms of the paths are taken from the dimensions of the pixel sample, nullptr for independent randoms
+			// the caller sets it as the RandSource of Math too, so that lights and BSDFs draw from it
+			void SetSampler(Basic::Ptr<Basic::Sampler> sampler) { this->sampler = sampler; }
+			const Basic::Ptr<Basic::Sampler> GetSampler() const { return sampler; }
+
 			virtual void Init(Basic::Ptr<Scene> scene, Basic::Ptr<BVHAccel> bvhAccel) {
 				this->bvhAccel = bvhAccel;
 			}
 
+		public:
+			// dimensions of a pixel sample taken by the camera ray, the paths start after them
+			static constexpr int CAMERA_SAMPLE_DIMS = 2;
+
+		protected:
+			// the following dimensions are of the sample sampleIdx of pixel
+			void StartPixelSample(const Point2i & pixel, int sampleIdx) const {
+				if (sampler)
+					sampler->StartPixelSample(pixel, sampleIdx, CAMERA_SAMPLE_DIMS);
+			}
+
+			// [0.0f, 1.0f)
+			float Rand1D() const { return sampler ? sampler->Get1D() : Basic::Math::Rand_F(); }
+
 		protected:
 			Basic::Ptr<BVHAccel> bvhAccel;
+			Basic::Ptr<Basic::Sampler> sampler;
 		};
 	}
 }
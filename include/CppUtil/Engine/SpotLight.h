@@ -40,6 +40,8 @@ namespace CppUtil {
 
 			virtual bool IsDelta() const override { return true; }
 
+			virtual bool GetBounds(BBoxf & box, Normalf & axis, float & cosTheta_o, float & cosTheta_e, float & power) const override;
+
 		public:
 			float CosHalfAngle() const{
 				return cos(Basic::Math::Radians(angle) / 2);
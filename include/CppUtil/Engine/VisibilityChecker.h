@@ -33,6 +33,15 @@ namespace CppUtil {
 
 			Rst & GetRst() { return rst; }
 
+			// same as bvhAccel->Accept(This()), without the dispatch of Visitor
+			// makes no heap allocation
+			void Intersect(const BVHAccel & bvhAccel);
+
+			// occlusion of rays[0, num) in their [tMin, tMax] at once, num <= RAY_PACKET_SIZE
+			// return the mask of the occluded rays
+			// makes no heap allocation
+			int IntersectPacket(const BVHAccel & bvhAccel, const Ray * rays, int num);
+
 		private:
 			//  rstཻ޸ ray.tMax
 			void Visit(Basic::Ptr<BVHAccel> bvhAccel);
@@ -42,9 +51,6 @@ namespace CppUtil {
 			void Visit(Basic::Ptr<Disk> disk);
 			void Visit(Basic::Ptr<Capsule> capsule);
 
-		private:
-			bool Intersect(const BBoxf & bbox, const Val3f & invDir) const;
-
 		private:
 			Ray ray;
 			Rst rst;
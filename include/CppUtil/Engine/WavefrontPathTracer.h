@@ -0,0 +1,78 @@
+#ifndef _ENGINE_RTX_WAVEFRONT_PATH_TRACER_H_
+#define _ENGINE_RTX_WAVEFRONT_PATH_TRACER_H_
+
+#include <CppUtil/Engine/PathTracer.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace CppUtil {
+	namespace Engine {
+		// same estimator as PathTracer, but all paths of a batch advance one bounce at a time
+		// each bounce runs as stages over the whole batch: extend, shade, shadow
+		// rays are sorted by morton keys between the stages, so neighbouring rays visit the same nodes
+		// and the surfaces are shaded grouped by the type of their BSDF
+		// single rays are traced by PathTracer
+		class WavefrontPathTracer : public PathTracer {
+		public:
+			WavefrontPathTracer();
+
+		public:
+			static const Basic::Ptr<WavefrontPathTracer> New() { return Basic::New<WavefrontPathTracer>(); }
+
+		protected:
+			virtual ~WavefrontPathTracer() = default;
+
+		public:
+			virtual const RGBf Trace(Ray & ray) override { return PathTracer::Trace(ray); }
+
+			// rays are processed in batches of at most maxBatchSize paths
+			virtual void Trace(Ray * rays, const Point2i * pixels, int sampleIdx, int num, RGBf * radiances) override;
+
+		public:
+			int maxBatchSize;
+
+		private:
+			void TraceBatch(Ray * rays, const Point2i * pixels, int sampleIdx, int num, RGBf * radiances);
+
+			// closest hits of the active paths, by packets of the queue
+			void Extend(int activeNum);
+
+			// emission, light samples and next rays of the active paths, grouped by the type of their BSDF
+			// the continuing paths are put into nextQueue, the light samples into the shadow arrays
+			// path i is the sample sampleIdx of pixels[i]
+			void Shade(int activeNum, int depth, const Point2i * pixels, int sampleIdx, RGBf * radiances, int & nextNum, int & shadowNum);
+
+			// light samples which are not occluded are added to their pixels
+			void Shadow(int shadowNum, RGBf * radiances);
+
+			// keyArr[idx] of rays[idx] for the idx in queue[0, num)
+			// the octant of the direction on top of the morton code of the origin in the scene box
+			void ComputeRayKeys(const std::vector<int> & queue, int num, const std::vector<Ray> & rays);
+
+			// sort queue[0, num) by keyArr, ties by index
+			void SortQueue(std::vector<int> & queue, int num) const;
+
+		private:
+			// path states in SoA form, indexed by path
+			std::vector<Ray> rayArr;
+			std::vector<RGBf> throughputArr;
+			std::vector<RayIntersector::Rst> rstArr;
+			std::vector<SurfaceHit> hitArr;
+
+			// path indices of the active paths and of the paths of the next bounce
+			std::vector<int> activeQueue;
+			std::vector<int> nextQueue;
+
+			// light samples, shadow ray, path and unoccluded radiance
+			std::vector<Ray> shadowRayArr;
+			std::vector<int> shadowPathArr;
+			std::vector<RGBf> shadowLArr;
+			std::vector<int> shadowQueue;
+
+			std::vector<uint64_t> keyArr;
+		};
+	}
+}
+
+#endif//!_ENGINE_RTX_WAVEFRONT_PATH_TRACER_H_
@@ -0,0 +1,264 @@
+#ifndef _ENGINE_RTX_WIDE_BVH_NODE_H_
+#define _ENGINE_RTX_WIDE_BVH_NODE_H_
+
+#include <CppUtil/Basic/UGM/BBox.h>
+
+#include <immintrin.h>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+
+namespace CppUtil {
+	namespace Engine {
+#ifdef __AVX__
+		constexpr int BVH_WIDTH = 8;
+#else
+		constexpr int BVH_WIDTH = 4;
+#endif
+		// the builder falls back to median splits to keep the tree within this depth
+		constexpr int BVH_MAX_DEPTH = 80;
+		// each popped node pushes at most BVH_WIDTH entries, so a fixed traversal stack suffices
+		constexpr int BVH_STACK_SIZE = BVH_MAX_DEPTH * (BVH_WIDTH - 1) + 1;
+
+		// N-wide BVH node, bounds of the children are stored in SoA form
+		// N should be a multiple of 4
+		template<int N>
+		class alignas(16) WideBVHNode {
+		public:
+			WideBVHNode() {
+				for (int i = 0; i < N; i++)
+					SetEmpty(i);
+			}
+
+		public:
+			// full precision bounds do not depend on the box of the node
+			void Init(const BBoxf & box) { }
+
+			void SetEmpty(int i) {
+				constexpr float inf = std::numeric_limits<float>::infinity();
+				for (int axis = 0; axis < 3; axis++) {
+					bounds[0][axis][i] = inf;
+					bounds[1][axis][i] = -inf;
+				}
+				offset[i] = -1;
+				num[i] = 0;
+			}
+
+			void SetLeaf(int i, const BBoxf & box, int shapesOffset, int shapesNum) {
+				SetBox(i, box);
+				offset[i] = shapesOffset;
+				num[i] = static_cast<uint16_t>(shapesNum);
+			}
+
+			void SetInterior(int i, const BBoxf & box, int nodeIdx) {
+				SetBox(i, box);
+				offset[i] = nodeIdx;
+				num[i] = 0;
+			}
+
+		public:
+			bool IsEmpty(int i) const { return offset[i] < 0; }
+			bool IsLeaf(int i) const { return num[i] != 0; }
+			int GetChildIdx(int i) const { return offset[i]; }
+			int GetShapesOffset(int i) const { return offset[i]; }
+			int GetShapesNum(int i) const { return num[i]; }
+
+			// test the ray against all children at once
+			// @arg dirIsNeg 1 if the component of direction is negative
+			// @arg tNear out, entry distances of the children
+			// @return bit i is set if child i is hit in [tMin, tMax]
+			int Intersect(const Point3 & origin, const Val3f & invDir, const int dirIsNeg[3],
+				float tMin, float tMax, float * tNear) const;
+
+		private:
+			void SetBox(int i, const BBoxf & box) {
+				for (int axis = 0; axis < 3; axis++) {
+					bounds[0][axis][i] = box.minP[axis];
+					bounds[1][axis][i] = box.maxP[axis];
+				}
+			}
+
+		private:
+			float bounds[2][3][N]; // [min/max][axis][child]
+			int offset[N]; // leaf: shapes offset, interior: node index, empty: -1
+			uint16_t num[N]; // leaf: shapes num, interior: 0
+		};
+
+		template<int N>
+		inline int WideBVHNode<N>::Intersect(const Point3 & origin, const Val3f & invDir, const int dirIsNeg[3],
+			float tMin, float tMax, float * tNear) const
+		{
+			int mask = 0;
+			for (int i = 0; i < N; i += 4) {
+				__m128 t0 = _mm_set1_ps(tMin);
+				__m128 t1 = _mm_set1_ps(tMax);
+				for (int axis = 0; axis < 3; axis++) {
+					const __m128 o = _mm_set1_ps(origin[axis]);
+					const __m128 invD = _mm_set1_ps(invDir[axis]);
+					const __m128 nearPlane = _mm_load_ps(&bounds[dirIsNeg[axis]][axis][i]);
+					const __m128 farPlane = _mm_load_ps(&bounds[1 - dirIsNeg[axis]][axis][i]);
+					// NaN (0 * inf) keeps the second operand
+					t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(nearPlane, o), invD), t0);
+					t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(farPlane, o), invD), t1);
+				}
+				_mm_storeu_ps(tNear + i, t0);
+				mask |= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << i;
+			}
+			return mask;
+		}
+
+#ifdef __AVX__
+		template<>
+		inline int WideBVHNode<8>::Intersect(const Point3 & origin, const Val3f & invDir, const int dirIsNeg[3],
+			float tMin, float tMax, float * tNear) const
+		{
+			__m256 t0 = _mm256_set1_ps(tMin);
+			__m256 t1 = _mm256_set1_ps(tMax);
+			for (int axis = 0; axis < 3; axis++) {
+				const __m256 o = _mm256_set1_ps(origin[axis]);
+				const __m256 invD = _mm256_set1_ps(invDir[axis]);
+				const __m256 nearPlane = _mm256_loadu_ps(bounds[dirIsNeg[axis]][axis]);
+				const __m256 farPlane = _mm256_loadu_ps(bounds[1 - dirIsNeg[axis]][axis]);
+				t0 = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(nearPlane, o), invD), t0);
+				t1 = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(farPlane, o), invD), t1);
+			}
+			_mm256_storeu_ps(tNear, t0);
+			return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+		}
+#endif
+
+		// WideBVHNode with child bounds quantized to 8 bits in the box of the node, about half the size
+		// bounds are rounded outwards, so the tests are conservative
+		template<int N>
+		class alignas(16) CompressedWideBVHNode {
+		public:
+			CompressedWideBVHNode() {
+				for (int axis = 0; axis < 3; axis++) {
+					base[axis] = 0.f;
+					scale[axis] = 0.f;
+				}
+				childMask = 0;
+				for (int i = 0; i < N; i++)
+					SetEmpty(i);
+			}
+
+		public:
+			// must be called before the children are set
+			void Init(const BBoxf & box) {
+				for (int axis = 0; axis < 3; axis++) {
+					const float extent = box.maxP[axis] - box.minP[axis];
+					base[axis] = box.minP[axis];
+					scale[axis] = extent > 0 ? extent / 255.f : 0.f;
+					// the decoded top must cover the box despite rounding
+					while (base[axis] + 255.f * scale[axis] < box.maxP[axis])
+						scale[axis] = scale[axis] * 1.0625f + std::numeric_limits<float>::denorm_min();
+				}
+			}
+
+			void SetEmpty(int i) {
+				for (int axis = 0; axis < 3; axis++) {
+					qBounds[0][axis][i] = 255;
+					qBounds[1][axis][i] = 0;
+				}
+				childMask &= ~(1 << i);
+				offset[i] = -1;
+				num[i] = 0;
+			}
+
+			void SetLeaf(int i, const BBoxf & box, int shapesOffset, int shapesNum) {
+				SetBox(i, box);
+				offset[i] = shapesOffset;
+				num[i] = static_cast<uint16_t>(shapesNum);
+			}
+
+			void SetInterior(int i, const BBoxf & box, int nodeIdx) {
+				SetBox(i, box);
+				offset[i] = nodeIdx;
+				num[i] = 0;
+			}
+
+		public:
+			bool IsEmpty(int i) const { return offset[i] < 0; }
+			bool IsLeaf(int i) const { return num[i] != 0; }
+			int GetChildIdx(int i) const { return offset[i]; }
+			int GetShapesOffset(int i) const { return offset[i]; }
+			int GetShapesNum(int i) const { return num[i]; }
+
+			// same as WideBVHNode::Intersect, the bounds are decoded on the fly
+			int Intersect(const Point3 & origin, const Val3f & invDir, const int dirIsNeg[3],
+				float tMin, float tMax, float * tNear) const;
+
+		private:
+			float Decode(int axis, int q) const { return base[axis] + q * scale[axis]; }
+
+			void SetBox(int i, const BBoxf & box) {
+				for (int axis = 0; axis < 3; axis++) {
+					if (scale[axis] == 0.f) {
+						qBounds[0][axis][i] = 0;
+						qBounds[1][axis][i] = 0;
+						continue;
+					}
+
+					const float invScale = 1.f / scale[axis];
+					int qMin = static_cast<int>(std::floor((box.minP[axis] - base[axis]) * invScale));
+					int qMax = static_cast<int>(std::ceil((box.maxP[axis] - base[axis]) * invScale));
+					qMin = qMin < 0 ? 0 : (qMin > 255 ? 255 : qMin);
+					qMax = qMax < 0 ? 0 : (qMax > 255 ? 255 : qMax);
+					while (qMin > 0 && Decode(axis, qMin) > box.minP[axis])
+						qMin--;
+					while (qMax < 255 && Decode(axis, qMax) < box.maxP[axis])
+						qMax++;
+					qBounds[0][axis][i] = static_cast<uint8_t>(qMin);
+					qBounds[1][axis][i] = static_cast<uint8_t>(qMax);
+				}
+				childMask |= 1 << i;
+			}
+
+			// 4 quantized bounds to floats, SSE2 only
+			static __m128 LoadQuantized4(const uint8_t * q) {
+				int bits;
+				memcpy(&bits, q, sizeof(int));
+				const __m128i zero = _mm_setzero_si128();
+				__m128i v = _mm_cvtsi32_si128(bits);
+				v = _mm_unpacklo_epi8(v, zero);
+				v = _mm_unpacklo_epi16(v, zero);
+				return _mm_cvtepi32_ps(v);
+			}
+
+		private:
+			float base[3]; // min corner of the node box
+			float scale[3]; // extent / 255, or a bit more
+			uint8_t qBounds[2][3][N]; // [min/max][axis][child]
+			int childMask; // bit i is set if child i is not empty
+			int offset[N]; // leaf: shapes offset, interior: node index, empty: -1
+			uint16_t num[N]; // leaf: shapes num, interior: 0
+		};
+
+		template<int N>
+		inline int CompressedWideBVHNode<N>::Intersect(const Point3 & origin, const Val3f & invDir, const int dirIsNeg[3],
+			float tMin, float tMax, float * tNear) const
+		{
+			int mask = 0;
+			for (int i = 0; i < N; i += 4) {
+				__m128 t0 = _mm_set1_ps(tMin);
+				__m128 t1 = _mm_set1_ps(tMax);
+				for (int axis = 0; axis < 3; axis++) {
+					const __m128 o = _mm_set1_ps(origin[axis]);
+					const __m128 invD = _mm_set1_ps(invDir[axis]);
+					const __m128 b = _mm_set1_ps(base[axis]);
+					const __m128 s = _mm_set1_ps(scale[axis]);
+					const __m128 nearPlane = _mm_add_ps(b, _mm_mul_ps(LoadQuantized4(&qBounds[dirIsNeg[axis]][axis][i]), s));
+					const __m128 farPlane = _mm_add_ps(b, _mm_mul_ps(LoadQuantized4(&qBounds[1 - dirIsNeg[axis]][axis][i]), s));
+					t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(nearPlane, o), invD), t0);
+					t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(farPlane, o), invD), t1);
+				}
+				_mm_storeu_ps(tNear + i, t0);
+				mask |= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << i;
+			}
+			return mask & childMask;
+		}
+	}
+}
+
+#endif//!_ENGINE_RTX_WIDE_BVH_NODE_H_
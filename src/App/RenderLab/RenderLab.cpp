@@ -10,7 +10,9 @@
 #include <CppUtil/Qt/OpThread.h>
 
 #include <CppUtil/Engine/RTX_Renderer.h>
+#include <CppUtil/Engine/BVHAccel.h>
 #include <CppUtil/Engine/PathTracer.h>
+#include <CppUtil/Engine/WavefrontPathTracer.h>
 #include <CppUtil/Engine/Viewer.h>
 #include <CppUtil/Engine/Scene.h>
 #include <CppUtil/Engine/SObj.h>
@@ -20,6 +22,9 @@
 #include <CppUtil/Basic/LambdaOp.h>
 #include <CppUtil/Basic/GStorage.h>
 #include <CppUtil/Basic/Math.h>
+#include <CppUtil/Basic/SobolSampler.h>
+#include <CppUtil/Basic/HaltonSampler.h>
+#include <CppUtil/Basic/PMJ02Sampler.h>
 
 #include <ROOT_PATH.h>
 
@@ -37,7 +42,7 @@ using namespace std;
 using namespace Ui;
 
 RenderLab::RenderLab(QWidget *parent)
-	: QMainWindow(parent), maxDepth(5), maxLoop(20)
+	: QMainWindow(parent), maxDepth(5), maxLoop(20), isWavefront(false), samplerType(SamplerType::Sobol), lightSamplerType(LightSamplerType::BVH)
 {
 	ui.setupUi(this);
 
@@ -70,14 +75,45 @@ RenderLab::RenderLab(QWidget *parent)
 	paintImgOp = pioc.GenScenePaintOp();
 
 	auto generator = [&]()->Ptr<PathTracer>{
-		auto pathTracer = PathTracer::New();
+		auto pathTracer = isWavefront ? WavefrontPathTracer::New() : PathTracer::New();
 		pathTracer->maxDepth = maxDepth;
+		switch (samplerType)
+		{
+		case SamplerType::Sobol:
+			pathTracer->SetSampler(SobolSampler::New());
+			break;
+		case SamplerType::Halton:
+			pathTracer->SetSampler(HaltonSampler::New());
+			break;
+		case SamplerType::PMJ02:
+			pathTracer->SetSampler(PMJ02Sampler::New());
+			break;
+		default:
+			break;
+		}
+		switch (lightSamplerType)
+		{
+		case LightSamplerType::Uniform:
+			pathTracer->lightSampleMode = LightSampler::Mode::Uniform;
+			break;
+		case LightSamplerType::Power:
+			pathTracer->lightSampleMode = LightSampler::Mode::Power;
+			break;
+		case LightSamplerType::BVH:
+			pathTracer->lightSampleMode = LightSampler::Mode::BVH;
+			break;
+		default:
+			break;
+		}
 
 		return pathTracer;
 	};
 
 	rtxRenderer = RTX_Renderer::New(generator);
 	rtxRenderer->maxLoop = maxLoop;
+	rtxRenderer->SetBVHCacheDir(ROOT_PATH + "data/cache/bvh/");
+	// fast builds while editing, switch to SAH or SBVH in the setting for final renders
+	rtxRenderer->GetBVHAccel()->SetBuildMode(BVHAccel::BuildMode::HLBVH);
 	
 	// init ui
 
@@ -203,11 +239,43 @@ void RenderLab::InitSetting() {
 	setting->AddEditVal("- Sample Num", maxLoop, 1, 1024, [&](int val) {
 		rtxRenderer->maxLoop = val;
 	});
+	setting->AddEditVal("- Error Threshold", 0.0, 0.0, 0.1, 100, [&](double val) {
+		rtxRenderer->errorThreshold = static_cast<float>(val);
+	});
+	setting->AddEditVal("- Min Sample Num", rtxRenderer->minLoop, 1, 1024, [&](int val) {
+		rtxRenderer->minLoop = val;
+	});
+	// seconds, 0 renders Sample Num passes
+	setting->AddEditVal("- Time Budget", rtxRenderer->timeBudget, 1.0);
+	setting->AddEditVal("- Tile Size", rtxRenderer->tileSize, 8, 256, [&](int val) {
+		rtxRenderer->tileSize = val;
+	});
+	Grid::pSlotMap bvhSlotMap = std::make_shared<Grid::SlotMap>();
+	(*bvhSlotMap)["HLBVH"] = [this]() {rtxRenderer->GetBVHAccel()->SetBuildMode(BVHAccel::BuildMode::HLBVH); };
+	(*bvhSlotMap)["LBVH"] = [this]() {rtxRenderer->GetBVHAccel()->SetBuildMode(BVHAccel::BuildMode::LBVH); };
+	(*bvhSlotMap)["SAH"] = [this]() {rtxRenderer->GetBVHAccel()->SetBuildMode(BVHAccel::BuildMode::SAH); };
+	(*bvhSlotMap)["SBVH"] = [this]() {rtxRenderer->GetBVHAccel()->SetBuildMode(BVHAccel::BuildMode::SBVH); };
+	setting->AddComboBox("- BVH Build", "HLBVH", bvhSlotMap);
 	
 	setting->AddTitle("[ PathTracer ]");
 	setting->AddEditVal("- Max Depth", maxDepth, 1, 100, [&](int val) {
 		maxDepth = val;
 	});
+	Grid::pSlotMap integratorSlotMap = std::make_shared<Grid::SlotMap>();
+	(*integratorSlotMap)["Packet"] = [this]() {isWavefront = false; };
+	(*integratorSlotMap)["Wavefront"] = [this]() {isWavefront = true; };
+	setting->AddComboBox("- Integrator", "Packet", integratorSlotMap);
+	Grid::pSlotMap samplerSlotMap = std::make_shared<Grid::SlotMap>();
+	(*samplerSlotMap)["Sobol"] = [this]() {samplerType = SamplerType::Sobol; };
+	(*samplerSlotMap)["Halton"] = [this]() {samplerType = SamplerType::Halton; };
+	(*samplerSlotMap)["PMJ02"] = [this]() {samplerType = SamplerType::PMJ02; };
+	(*samplerSlotMap)["Random"] = [this]() {samplerType = SamplerType::Random; };
+	setting->AddComboBox("- Sampler", "Sobol", samplerSlotMap);
+	Grid::pSlotMap lightSamplerSlotMap = std::make_shared<Grid::SlotMap>();
+	(*lightSamplerSlotMap)["BVH"] = [this]() {lightSamplerType = LightSamplerType::BVH; };
+	(*lightSamplerSlotMap)["Power"] = [this]() {lightSamplerType = LightSamplerType::Power; };
+	(*lightSamplerSlotMap)["Uniform"] = [this]() {lightSamplerType = LightSamplerType::Uniform; };
+	setting->AddComboBox("- Light Sampler", "BVH", lightSamplerSlotMap);
 
 	setting->AddTitle("[ Viewer ]");
 	Grid::pSlotMap slotmap = std::make_shared<Grid::SlotMap>();
@@ -51,4 +51,9 @@ private:
 	// setting
 	int maxDepth;
 	int maxLoop;
+	bool isWavefront;
+	enum class SamplerType { Random, Sobol, Halton, PMJ02 };
+	SamplerType samplerType;
+	enum class LightSamplerType { Uniform, Power, BVH };
+	LightSamplerType lightSamplerType;
 };
@@ -8,6 +8,7 @@
 #include <CppUtil/Qt/OpThread.h>
 
 #include <CppUtil/Engine/RTX_Renderer.h>
+#include <CppUtil/Engine/BVHAccel.h>
 #include <CppUtil/Engine/PathTracer.h>
 #include <CppUtil/Engine/Viewer.h>
 #include <CppUtil/Engine/Scene.h>
@@ -116,6 +117,9 @@ void SObjRenderer::InitRTX() {
 	auto img = paintImgOp->GetImg();
 	rtxRenderer = RTX_Renderer::New(generator);
 	rtxRenderer->maxLoop = GetArgAs<int>(ENUM_ARG::samplenum);
+	rtxRenderer->SetBVHCacheDir(ROOT_PATH + "data/cache/bvh/");
+	// final quality, spend build time on a better tree
+	rtxRenderer->GetBVHAccel()->SetBuildMode(BVHAccel::BuildMode::SBVH);
 
 	drawImgThread = OpThread::New(LambdaOp_New([=]() {
 		rtxRenderer->Run(scene, img);
@@ -12,6 +12,8 @@
 #include <CppUtil/Basic/ImgPixelSet.h>
 #include <CppUtil/Basic/Math.h>
 
+#include <ROOT_PATH.h>
+
 #include <thread>
 
 #include <omp.h>
@@ -54,6 +56,8 @@ void RTX_Sampler::Run(Ptr<Scene> scene, Ptr<Image> img) {
 
 	// init ray 
 	auto bvhAccel = BVHAccel::New();
+	bvhAccel->SetCacheDir(ROOT_PATH + "data/cache/bvh/");
+	bvhAccel->SetBuildMode(BVHAccel::BuildMode::SBVH);
 	bvhAccel->Init(scene->GetRoot());
 	for (auto rayTracer : rayTracers)
 		rayTracer->Init(scene, bvhAccel);
@@ -81,6 +85,8 @@ void RTX_Sampler::Run(Ptr<Scene> scene, Ptr<Image> img) {
 		for (int i = 0; i < job.size(); i++) {
 			int x = job[i].x;
 			int y = job[i].y;
+			// one stream per pixel, reproducible whichever thread picks the pixel
+			Math::RandSeed(0, static_cast<uint64_t>(y) * w + x);
 
 			for (int k = 0; k < maxLoop; ++k) {
 				float u = (x + Math::Rand_F()) / (float)w;
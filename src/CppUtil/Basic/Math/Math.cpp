@@ -1,38 +1,47 @@
 #include <CppUtil/Basic/Math.h>
-#include <random>
+#include <CppUtil/Basic/PCG32.h>
 
 #include <ctime>
+#include <thread>
+#include <functional>
 
 using namespace CppUtil::Basic;
 using namespace std;
 
-static uniform_int_distribution<unsigned> uiMap;
-static uniform_int_distribution<signed> iMap;
-static uniform_real_distribution<float> fMap(0.0f,1.0f);
-static uniform_real_distribution<float> fMap_exclude1(0.0f, 0.99999999f);
-static uniform_real_distribution<double> dMap(0.0,1.0);
-static default_random_engine engine;
+// one generator per thread, no locking and no shared cache line
+static thread_local PCG32 engine(
+	0x853c49e6748fea9bULL,
+	hash<thread::id>()(this_thread::get_id()));
+static thread_local Math::RandSource * randSource = nullptr;
 
 int Math::Rand_I() {
-	return iMap(engine);
+	return static_cast<int>(engine.NextUInt() >> 1);
 }
 
 unsigned int Math::Rand_UI() {
-	return uiMap(engine);
+	return engine.NextUInt();
 }
 
 float Math::Rand_F() {
-	return fMap(engine);
+	return randSource ? randSource->Next1D() : engine.NextFloat();
 }
 
 float Math::Rand_F_exclude1() {
-	return fMap_exclude1(engine);
+	return randSource ? randSource->Next1D() : engine.NextFloat();
 }
 
 double Math::Rand_D() {
-	return dMap(engine);
+	return randSource ? randSource->Next1D() : engine.NextDouble();
+}
+
+void Math::RandSeed(uint64_t seed, uint64_t stream) {
+	engine.Seed(seed, stream);
 }
 
 void Math::RandSetSeedByCurTime() {
-	engine.seed(clock());
+	engine.Seed(static_cast<uint64_t>(clock()), hash<thread::id>()(this_thread::get_id()));
+}
+
+void Math::SetRandSource(RandSource * source) {
+	randSource = source;
 }
@@ -52,7 +52,11 @@ void AliasMethod::Init(const vector<double> & distribution) {
 }
 
 int AliasMethod::Sample() const {
-	double x = Math::Rand_D();
+	double p;
+	return Sample(Math::Rand_D(), p);
+}
+
+int AliasMethod::Sample(double x, double & p) const {
 	auto n = static_cast<int>(table.size());
 	auto nx = n * x;
 
@@ -66,10 +70,11 @@ int AliasMethod::Sample() const {
 	// [0, 1)
 	auto y = nx - i;
 
-	if (y < table[i].u)
-		return i;
-	else
-		return table[i].k;
+	if (y >= table[i].u)
+		i = table[i].k;
+
+	p = P(i);
+	return i;
 }
 
 int AliasMethod::Sample(double & p) const {
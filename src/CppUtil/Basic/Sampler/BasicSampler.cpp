@@ -5,6 +5,16 @@
 using namespace CppUtil;
 using namespace CppUtil::Basic;
 
+namespace {
+	// 1 - cos(theta), with the series of sqrt for small theta
+	float OneMinusCos(float sin2Theta) {
+		if (sin2Theta < 0.01f)
+			return sin2Theta * (0.5f + sin2Theta * (0.125f + sin2Theta * 0.0625f));
+
+		return 1.f - std::sqrt(1.f - sin2Theta);
+	}
+}
+
 const Point2 BasicSampler::UniformInSquare() {
 	return { Math::Rand_F(), Math::Rand_F() };
 }
@@ -60,6 +70,19 @@ const Vec3 BasicSampler::UniformOnSphere(float & pd) {
 	return UniformOnSphere();
 }
 
+const Vec3 BasicSampler::UniformInCone(float sin2ThetaMax) {
+	const float oneMinusCosTheta = Math::Rand_F() * OneMinusCos(sin2ThetaMax);
+	const float cosTheta = 1 - oneMinusCosTheta;
+	const float sinTheta = std::sqrt(oneMinusCosTheta * (2 - oneMinusCosTheta));
+	const float phi = 2 * Math::PI * Math::Rand_F();
+
+	return { sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta };
+}
+
+float BasicSampler::PDofUniformInCone(float sin2ThetaMax) {
+	return 1.f / (2.f * Math::PI * OneMinusCos(sin2ThetaMax));
+}
+
 const Vec3 BasicSampler::CosOnHalfSphere() {
 	auto pInDisk = UniformInDisk();
 	float z = sqrt(1 - pInDisk.x * pInDisk.x - pInDisk.y*pInDisk.y);
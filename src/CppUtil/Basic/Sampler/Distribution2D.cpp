@@ -0,0 +1,121 @@
+#include <CppUtil/Basic/Distribution2D.h>
+
+#include <CppUtil/Basic/Math.h>
+
+#include <algorithm>
+#include <future>
+#include <thread>
+
+using namespace CppUtil;
+using namespace CppUtil::Basic;
+using namespace std;
+
+namespace {
+	// the largest float below 1
+	constexpr float ONE_MINUS_EPSILON = 0.99999994f;
+
+	// func[0, n) into its cdf in place, returns the sum of func
+	double ToCDF(float * func, int n) {
+		double sum = 0.0;
+		for (int i = 0; i < n; i++)
+			sum += func[i];
+
+		if (sum <= 0.0) {
+			for (int i = 0; i < n; i++)
+				func[i] = (i + 1) / static_cast<float>(n);
+			return 0.0;
+		}
+
+		double prefix = 0.0;
+		for (int i = 0; i < n; i++) {
+			prefix += func[i];
+			func[i] = static_cast<float>(prefix / sum);
+		}
+		func[n - 1] = 1.f;
+		return sum;
+	}
+
+	// index i of cdf[0, n) with cdf[i - 1] <= u < cdf[i]
+	// @arg3 out, u within the cell, in [0, 1)
+	// @arg4 out, probability of the cell
+	int SampleCDF(const float * cdf, int n, float u, float & du, float & p) {
+		const int i = min(static_cast<int>(upper_bound(cdf, cdf + n, u) - cdf), n - 1);
+		const float prev = i > 0 ? cdf[i - 1] : 0.f;
+		p = cdf[i] - prev;
+		du = p > 0 ? min((u - prev) / p, ONE_MINUS_EPSILON) : 0.f;
+		return i;
+	}
+}
+
+void Distribution2D::Init(int width, int height, const function<void(int y, float * row)> & fillRow) {
+	Clear();
+	if (width <= 0 || height <= 0)
+		return;
+
+	this->width = width;
+	this->height = height;
+	conditionalCDFs.resize(static_cast<size_t>(width) * height);
+	vector<double> rowSums(height);
+
+	// rows of a task are contiguous, so each task writes its own part of conditionalCDFs
+	const int taskNum = max(1, min(height, static_cast<int>(thread::hardware_concurrency())));
+	const int chunkSize = (height + taskNum - 1) / taskNum;
+	auto buildRows = [&](int taskIdx) {
+		const int end = min(height, (taskIdx + 1) * chunkSize);
+		for (int y = taskIdx * chunkSize; y < end; y++) {
+			float * row = &conditionalCDFs[static_cast<size_t>(y) * width];
+			fillRow(y, row);
+			rowSums[y] = ToCDF(row, width);
+		}
+	};
+
+	vector<future<void>> tasks;
+	for (int i = 1; i < taskNum; i++)
+		tasks.push_back(async(launch::async, buildRows, i));
+	buildRows(0);
+	for (auto & task : tasks)
+		task.get();
+
+	marginalCDF.resize(height);
+	double sum = 0.0;
+	for (double rowSum : rowSums)
+		sum += rowSum;
+	double prefix = 0.0;
+	for (int y = 0; y < height; y++) {
+		// a function of all 0 is uniform, as its rows are
+		prefix += sum > 0.0 ? rowSums[y] : 1.0;
+		marginalCDF[y] = static_cast<float>(prefix / (sum > 0.0 ? sum : height));
+	}
+	marginalCDF[height - 1] = 1.f;
+}
+
+void Distribution2D::Clear() {
+	width = 0;
+	height = 0;
+	conditionalCDFs.clear();
+	conditionalCDFs.shrink_to_fit();
+	marginalCDF.clear();
+	marginalCDF.shrink_to_fit();
+}
+
+const Point2 Distribution2D::Sample(float u0, float u1, float & pd) const {
+	float dv, pv;
+	const int y = SampleCDF(marginalCDF.data(), height, u1, dv, pv);
+
+	float du, pu;
+	const int x = SampleCDF(&conditionalCDFs[static_cast<size_t>(y) * width], width, u0, du, pu);
+
+	pd = pv * pu * width * height;
+	return Point2((x + du) / width, (y + dv) / height);
+}
+
+float Distribution2D::PDF(const Point2 & pos) const {
+	const int x = Math::Clamp(static_cast<int>(pos.x * width), 0, width - 1);
+	const int y = Math::Clamp(static_cast<int>(pos.y * height), 0, height - 1);
+
+	const float pv = marginalCDF[y] - (y > 0 ? marginalCDF[y - 1] : 0.f);
+	const float * row = &conditionalCDFs[static_cast<size_t>(y) * width];
+	const float pu = row[x] - (x > 0 ? row[x - 1] : 0.f);
+
+	return pv * pu * width * height;
+}
@@ -0,0 +1,23 @@
+#include <CppUtil/Basic/HaltonSampler.h>
+
+#include <CppUtil/Basic/LowDiscrepancy.h>
+
+using namespace CppUtil::Basic;
+
+float HaltonSampler::Sample1D(int dim) const {
+	return Value(dim);
+}
+
+const Point2 HaltonSampler::Sample2D(int dim) const {
+	return Point2(Value(dim), Value(dim + 1));
+}
+
+float HaltonSampler::Value(int dim) const {
+	const int block = dim / LowDiscrepancy::HALTON_DIMS;
+	uint64_t index = static_cast<uint64_t>(sampleIdx);
+	// a run of points at any index is well distributed as well, so later blocks just start elsewhere
+	if (block > 0)
+		index += Hash(-block) & 0xFFFFFF;
+
+	return LowDiscrepancy::OwenScrambledRadicalInverse(dim % LowDiscrepancy::HALTON_DIMS, index, Hash(dim));
+}
@@ -0,0 +1,162 @@
+#include <CppUtil/Basic/LowDiscrepancy.h>
+
+using namespace CppUtil::Basic;
+
+namespace CppUtil {
+	namespace Basic {
+		namespace LowDiscrepancy {
+			// primitive polynomial x^s + a_1 x^(s-1) + ... + a_(s-1) x + 1 and initial direction numbers m
+			// of the dimensions 1 to SOBOL_DIMS - 1, dimension 0 is the van der Corput sequence
+			struct SobolPolynomial {
+				int s;
+				uint32_t a;
+				uint32_t m[6];
+			};
+
+			static const SobolPolynomial sobolPolynomials[SOBOL_DIMS - 1] = {
+				{ 1, 0, { 1 } },
+				{ 2, 1, { 1, 3 } },
+				{ 3, 1, { 1, 3, 1 } },
+				{ 3, 2, { 1, 1, 1 } },
+				{ 4, 1, { 1, 1, 3, 3 } },
+				{ 4, 4, { 1, 3, 5, 13 } },
+				{ 5, 2, { 1, 1, 5, 5, 17 } },
+				{ 5, 4, { 1, 1, 5, 5, 5 } },
+				{ 5, 7, { 1, 1, 7, 11, 19 } },
+				{ 5, 11, { 1, 1, 5, 1, 1 } },
+				{ 5, 13, { 1, 1, 1, 3, 11 } },
+				{ 5, 14, { 1, 3, 5, 5, 31 } },
+				{ 6, 1, { 1, 3, 3, 9, 7, 49 } },
+				{ 6, 13, { 1, 1, 1, 15, 21, 21 } },
+				{ 6, 16, { 1, 3, 1, 13, 27, 49 } },
+			};
+
+			// column k of dimension dim is the fraction for bit k of the index
+			struct SobolMatrices {
+				SobolMatrices() {
+					for (int k = 0; k < 32; k++)
+						v[0][k] = 1u << (31 - k);
+
+					for (int dim = 1; dim < SOBOL_DIMS; dim++) {
+						const auto & poly = sobolPolynomials[dim - 1];
+						const int s = poly.s;
+						uint32_t * const col = v[dim];
+						for (int k = 0; k < s; k++)
+							col[k] = poly.m[k] << (31 - k);
+						for (int k = s; k < 32; k++) {
+							col[k] = col[k - s] ^ (col[k - s] >> s);
+							for (int j = 1; j < s; j++) {
+								if ((poly.a >> (s - 1 - j)) & 1)
+									col[k] ^= col[k - j];
+							}
+						}
+					}
+				}
+
+				uint32_t v[SOBOL_DIMS][32];
+			};
+
+			static const SobolMatrices sobolMatrices;
+
+			static const int primes[HALTON_DIMS] = {
+				2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+				59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+			};
+
+			// element i of a random permutation of [0, n), Kensler, Correlated Multi-Jittered Sampling, 2013
+			static uint32_t PermutationElement(uint32_t i, uint32_t n, uint32_t seed) {
+				uint32_t w = n - 1;
+				w |= w >> 1;
+				w |= w >> 2;
+				w |= w >> 4;
+				w |= w >> 8;
+				w |= w >> 16;
+				// a bijection of [0, w], walked until it lands in [0, n)
+				do {
+					i ^= seed;
+					i *= 0xe170893d;
+					i ^= seed >> 16;
+					i ^= (i & w) >> 4;
+					i ^= seed >> 8;
+					i *= 0x0929eb3f;
+					i ^= seed >> 23;
+					i ^= (i & w) >> 1;
+					i *= 1 | seed >> 27;
+					i *= 0x6935fa69;
+					i ^= (i & w) >> 11;
+					i *= 0x74dcb303;
+					i ^= (i & w) >> 2;
+					i *= 0x9e501cc3;
+					i ^= (i & w) >> 2;
+					i *= 0xc860a3df;
+					i &= w;
+					i ^= i >> 5;
+				} while (i >= n);
+				return (i + seed) % n;
+			}
+
+			static uint32_t ReverseBits(uint32_t x) {
+				x = (x << 16) | (x >> 16);
+				x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+				x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+				x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+				x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+				return x;
+			}
+		}
+	}
+}
+
+float LowDiscrepancy::ToFloat(uint32_t x) {
+	// 24 bits, so that it can not be rounded to 1
+	return (x >> 8) * (1.f / 16777216.f);
+}
+
+uint64_t LowDiscrepancy::MixBits(uint64_t x) {
+	x ^= x >> 31;
+	x *= 0x7fb5d329728ea185ULL;
+	x ^= x >> 27;
+	x *= 0x81dadef4bc2dd44dULL;
+	x ^= x >> 33;
+	return x;
+}
+
+uint32_t LowDiscrepancy::Sobol(uint32_t index, int dim) {
+	const uint32_t * col = sobolMatrices.v[dim];
+	uint32_t x = 0;
+	for (int k = 0; index != 0; index >>= 1, k++) {
+		if (index & 1)
+			x ^= col[k];
+	}
+	return x;
+}
+
+uint32_t LowDiscrepancy::OwenScramble(uint32_t x, uint32_t seed) {
+	// a bit only depends on the bits above it after the reversal
+	x = ReverseBits(x);
+	x ^= x * 0x3d20adea;
+	x += seed;
+	x *= (seed >> 16) | 1;
+	x ^= x * 0x05526c56;
+	x ^= x * 0x53a22864;
+	return ReverseBits(x);
+}
+
+float LowDiscrepancy::OwenScrambledRadicalInverse(int dim, uint64_t index, uint64_t seed) {
+	const uint32_t base = primes[dim];
+	const double invBase = 1.0 / base;
+	uint64_t reversedDigits = 0;
+	double invBaseM = 1;
+	// the digits after the last one of index are 0, but they are permuted as well, up to the precision of float
+	while ((base - 1) * invBaseM > 1.0 / 16777216.0) {
+		const uint64_t next = index / base;
+		const uint32_t digit = static_cast<uint32_t>(index - next * base);
+		const uint64_t digitHash = MixBits(seed ^ (reversedDigits * 0x9e3779b97f4a7c15ULL));
+		const uint32_t scrambledDigit = PermutationElement(digit, base, static_cast<uint32_t>(digitHash));
+		reversedDigits = reversedDigits * base + scrambledDigit;
+		invBaseM *= invBase;
+		index = next;
+	}
+	const float rst = static_cast<float>(invBaseM * reversedDigits);
+	return rst < 1.f ? rst : 0.99999994f;
+}
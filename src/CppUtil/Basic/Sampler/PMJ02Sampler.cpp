@@ -0,0 +1,24 @@
+#include <CppUtil/Basic/PMJ02Sampler.h>
+
+#include <CppUtil/Basic/LowDiscrepancy.h>
+
+using namespace CppUtil::Basic;
+
+float PMJ02Sampler::Sample1D(int dim) const {
+	const uint64_t hash = Hash(dim);
+	const uint32_t index = LowDiscrepancy::OwenScramble(static_cast<uint32_t>(sampleIdx), static_cast<uint32_t>(hash >> 32));
+	const uint32_t x = LowDiscrepancy::Sobol(index, 0);
+	return LowDiscrepancy::ToFloat(LowDiscrepancy::OwenScramble(x, static_cast<uint32_t>(hash)));
+}
+
+const Point2 PMJ02Sampler::Sample2D(int dim) const {
+	const uint64_t hash = Hash(dim);
+	// both coordinates take the same shuffled index, so the pair stays a (0, 2) sequence
+	const uint32_t index = LowDiscrepancy::OwenScramble(static_cast<uint32_t>(sampleIdx), static_cast<uint32_t>(hash >> 32));
+	const uint64_t hashY = LowDiscrepancy::MixBits(hash);
+	const uint32_t x = LowDiscrepancy::Sobol(index, 0);
+	const uint32_t y = LowDiscrepancy::Sobol(index, 1);
+	return Point2(
+		LowDiscrepancy::ToFloat(LowDiscrepancy::OwenScramble(x, static_cast<uint32_t>(hash))),
+		LowDiscrepancy::ToFloat(LowDiscrepancy::OwenScramble(y, static_cast<uint32_t>(hashY))));
+}
@@ -0,0 +1,48 @@
+#include <CppUtil/Basic/Sampler.h>
+
+#include <CppUtil/Basic/LowDiscrepancy.h>
+
+using namespace CppUtil::Basic;
+
+void Sampler::StartPixelSample(const Point2i & pixel, int sampleIdx, int dim) {
+	this->pixel = pixel;
+	this->sampleIdx = sampleIdx;
+	SetDimension(dim);
+}
+
+void Sampler::SetDimension(int dim) {
+	this->dim = dim;
+	hasPendingY = false;
+}
+
+float Sampler::Get1D() {
+	hasPendingY = false;
+	return Sample1D(dim++);
+}
+
+const Point2 Sampler::Get2D() {
+	hasPendingY = false;
+	const Point2 rst = Sample2D(dim);
+	dim += 2;
+	return rst;
+}
+
+float Sampler::Next1D() {
+	if (hasPendingY) {
+		hasPendingY = false;
+		return pendingY;
+	}
+
+	// 2D samples start at even dimensions, so that Xi1 and Xi2 of a draw are a pair
+	dim += dim & 1;
+	const Point2 rst = Sample2D(dim);
+	dim += 2;
+	pendingY = rst.y;
+	hasPendingY = true;
+	return rst.x;
+}
+
+uint64_t Sampler::Hash(int dim) const {
+	const uint64_t pixelKey = (static_cast<uint64_t>(static_cast<uint32_t>(pixel.x)) << 32) | static_cast<uint32_t>(pixel.y);
+	return LowDiscrepancy::MixBits(LowDiscrepancy::MixBits(pixelKey ^ seed) ^ static_cast<uint64_t>(dim));
+}
@@ -0,0 +1,24 @@
+#include <CppUtil/Basic/SobolSampler.h>
+
+#include <CppUtil/Basic/LowDiscrepancy.h>
+
+using namespace CppUtil::Basic;
+
+float SobolSampler::Sample1D(int dim) const {
+	return Value(dim);
+}
+
+const Point2 SobolSampler::Sample2D(int dim) const {
+	return Point2(Value(dim), Value(dim + 1));
+}
+
+float SobolSampler::Value(int dim) const {
+	const int block = dim / LowDiscrepancy::SOBOL_DIMS;
+	uint32_t index = static_cast<uint32_t>(sampleIdx);
+	// the blocks share the points, a shuffled index decorrelates them
+	if (block > 0)
+		index = LowDiscrepancy::OwenScramble(index, static_cast<uint32_t>(Hash(-block)));
+
+	const uint32_t x = LowDiscrepancy::Sobol(index, dim % LowDiscrepancy::SOBOL_DIMS);
+	return LowDiscrepancy::ToFloat(LowDiscrepancy::OwenScramble(x, static_cast<uint32_t>(Hash(dim))));
+}
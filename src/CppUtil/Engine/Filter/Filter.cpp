@@ -0,0 +1,12 @@
+#include <CppUtil/Engine/Filter.h>
+
+using namespace CppUtil;
+using namespace CppUtil::Basic;
+using namespace CppUtil::Engine;
+
+void Filter::InitTable() {
+	for (int axis = 0; axis < 2; axis++) {
+		for (int i = 0; i < TABLE_SIZE; i++)
+			table[axis][i] = Evaluate1D((i + 0.5f) / TABLE_SIZE * radius[axis], axis);
+	}
+}
@@ -0,0 +1,618 @@
+#ifndef _CPPUTIL_ENGINE_INTERSECTOR_INTERSECT_KERNEL_H_
+#define _CPPUTIL_ENGINE_INTERSECTOR_INTERSECT_KERNEL_H_
+
+#include <CppUtil/Engine/BVHAccel.h>
+#include <CppUtil/Engine/RayIntersector.h>
+
+#include <CppUtil/Basic/UGM/Point.h>
+#include <CppUtil/Basic/UGM/Vector.h>
+
+#include <cmath>
+#include <limits>
+
+namespace CppUtil {
+	namespace Engine {
+		// ray-primitive tests shared by the intersectors
+		// analytic shapes are in their local space, the direction need not be normalized
+		// return true and set t if there is a hit in [tMin, tMax]
+
+		inline bool IntersectTriangle(const Point3 & o, const Vec3 & d, float tMin, float tMax,
+			const Point3 & p1, const Point3 & p2, const Point3 & p3, float & t, float & u, float & v)
+		{
+			const auto e1 = p2 - p1;
+			const auto e2 = p3 - p1;
+
+			const auto e1_x_d = e1.Cross(d);
+			const float denominator = e1_x_d.Dot(e2);
+
+			if (denominator == 0)
+				return false;
+
+			const float inv_denominator = 1.0f / denominator;
+
+			const auto s = o - p1;
+
+			const auto e2_x_s = e2.Cross(s);
+			const float r1 = e2_x_s.Dot(d);
+			u = r1 * inv_denominator;
+			if (u < 0 || u > 1)
+				return false;
+
+			const float r2 = e1_x_d.Dot(s);
+			v = r2 * inv_denominator;
+			if (v < 0 || v > 1)
+				return false;
+
+			if (u + v > 1)
+				return false;
+
+			const float r3 = e2_x_s.Dot(e1);
+			t = r3 * inv_denominator;
+
+			return t >= tMin && t <= tMax;
+		}
+
+		// triangles [0, num) of the group at once, same arithmetic as IntersectTriangle
+		// return true and set the closest t, u, v and its lane if there is a hit in [tMin, tMax]
+		// of equal t the last lane wins, as the later triangle does in a scalar loop with t <= tMax
+		inline bool IntersectTriangleGroup(const Point3 & o, const Vec3 & d, float tMin, float tMax,
+			const BVHAccel::TriangleGroup & group, int num, float & t, float & u, float & v, int & lane)
+		{
+			static_assert(BVHAccel::TriangleGroup::size == 4, "SSE tests 4 triangles at once");
+
+			const __m128 e1x = _mm_load_ps(group.e1[0]);
+			const __m128 e1y = _mm_load_ps(group.e1[1]);
+			const __m128 e1z = _mm_load_ps(group.e1[2]);
+			const __m128 e2x = _mm_load_ps(group.e2[0]);
+			const __m128 e2y = _mm_load_ps(group.e2[1]);
+			const __m128 e2z = _mm_load_ps(group.e2[2]);
+			const __m128 dx = _mm_set1_ps(d.x);
+			const __m128 dy = _mm_set1_ps(d.y);
+			const __m128 dz = _mm_set1_ps(d.z);
+
+			// e1_x_d = e1.Cross(d)
+			const __m128 e1_x_d_x = _mm_sub_ps(_mm_mul_ps(e1y, dz), _mm_mul_ps(dy, e1z));
+			const __m128 e1_x_d_y = _mm_sub_ps(_mm_mul_ps(e1z, dx), _mm_mul_ps(dz, e1x));
+			const __m128 e1_x_d_z = _mm_sub_ps(_mm_mul_ps(e1x, dy), _mm_mul_ps(dx, e1y));
+
+			const __m128 denominator = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1_x_d_x, e2x), _mm_mul_ps(e1_x_d_y, e2y)), _mm_mul_ps(e1_x_d_z, e2z));
+			const __m128 inv_denominator = _mm_div_ps(_mm_set1_ps(1.f), denominator);
+
+			// s = o - p1
+			const __m128 sx = _mm_sub_ps(_mm_set1_ps(o.x), _mm_load_ps(group.p1[0]));
+			const __m128 sy = _mm_sub_ps(_mm_set1_ps(o.y), _mm_load_ps(group.p1[1]));
+			const __m128 sz = _mm_sub_ps(_mm_set1_ps(o.z), _mm_load_ps(group.p1[2]));
+
+			// e2_x_s = e2.Cross(s)
+			const __m128 e2_x_s_x = _mm_sub_ps(_mm_mul_ps(e2y, sz), _mm_mul_ps(sy, e2z));
+			const __m128 e2_x_s_y = _mm_sub_ps(_mm_mul_ps(e2z, sx), _mm_mul_ps(sz, e2x));
+			const __m128 e2_x_s_z = _mm_sub_ps(_mm_mul_ps(e2x, sy), _mm_mul_ps(sx, e2y));
+
+			const __m128 r1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2_x_s_x, dx), _mm_mul_ps(e2_x_s_y, dy)), _mm_mul_ps(e2_x_s_z, dz));
+			const __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1_x_d_x, sx), _mm_mul_ps(e1_x_d_y, sy)), _mm_mul_ps(e1_x_d_z, sz));
+			const __m128 r3 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2_x_s_x, e1x), _mm_mul_ps(e2_x_s_y, e1y)), _mm_mul_ps(e2_x_s_z, e1z));
+			const __m128 us = _mm_mul_ps(r1, inv_denominator);
+			const __m128 vs = _mm_mul_ps(r2, inv_denominator);
+			const __m128 ts = _mm_mul_ps(r3, inv_denominator);
+
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.f);
+			__m128 valid = _mm_cmpneq_ps(denominator, zero);
+			valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(us, zero), _mm_cmple_ps(us, one)));
+			valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(vs, zero), _mm_cmple_ps(vs, one)));
+			valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(us, vs), one));
+			valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(ts, _mm_set1_ps(tMin)), _mm_cmple_ps(ts, _mm_set1_ps(tMax))));
+
+			const int mask = _mm_movemask_ps(valid) & ((1 << num) - 1);
+			if (mask == 0)
+				return false;
+
+			alignas(16) float tArr[4];
+			alignas(16) float uArr[4];
+			alignas(16) float vArr[4];
+			_mm_store_ps(tArr, ts);
+			_mm_store_ps(uArr, us);
+			_mm_store_ps(vArr, vs);
+			lane = -1;
+			for (int i = 0; i < 4; i++) {
+				if ((mask & (1 << i)) && (lane == -1 || tArr[i] <= tArr[lane]))
+					lane = i;
+			}
+			t = tArr[lane];
+			u = uArr[lane];
+			v = vArr[lane];
+			return true;
+		}
+
+		// triangles [triOffset, triOffset + triNum) of a leaf of meshBVH, by groups
+		// return true and set the closest t, u, v and its triIdx if there is a hit in [tMin, tMax]
+		inline bool IntersectLeafTriangles(const BVHAccel::MeshBVH & meshBVH, const Point3 & o, const Vec3 & d, float tMin, float tMax,
+			int triOffset, int triNum, float & t, float & u, float & v, int & triIdx)
+		{
+			constexpr int groupSize = BVHAccel::TriangleGroup::size;
+			const int triEnd = triOffset + triNum;
+			bool isHit = false;
+			for (int first = triOffset; first < triEnd; first += groupSize) {
+				const int num = triEnd - first < groupSize ? triEnd - first : groupSize;
+				int lane;
+				if (IntersectTriangleGroup(o, d, tMin, tMax, meshBVH.triGroups[first / groupSize], num, t, u, v, lane)) {
+					tMax = t;
+					triIdx = first + lane;
+					isHit = true;
+				}
+			}
+			return isHit;
+		}
+
+		// nearest root of a * t^2 + 2 * b * t + c = 0 in [tMin, tMax]
+		inline bool SolveNearestRoot(float a, float b, float c, float tMin, float tMax, float & t) {
+			const float discriminant = b * b - a * c;
+			if (discriminant < 0 || a == 0)
+				return false;
+
+			const float sqrt_discriminant = sqrt(discriminant);
+			const float inv_a = 1.0f / a;
+
+			t = -(b + sqrt_discriminant) * inv_a;
+			if (t >= tMin && t <= tMax)
+				return true;
+
+			t = (sqrt_discriminant - b) * inv_a;
+			return t >= tMin && t <= tMax;
+		}
+
+		// unit sphere at the origin
+		inline bool IntersectSphere(const Point3 & o, const Vec3 & d, float tMin, float tMax, float & t) {
+			const Vec3 oc = o;
+			return SolveNearestRoot(d.Dot(d), oc.Dot(d), oc.Dot(oc) - 1, tMin, tMax, t);
+		}
+
+		// unit square in the xz plane
+		inline bool IntersectPlane(const Point3 & o, const Vec3 & d, float tMin, float tMax, float & t) {
+			t = -o.y / d.y;
+			if (!(t >= tMin && t <= tMax))
+				return false;
+
+			const float x = o.x + t * d.x;
+			const float z = o.z + t * d.z;
+			return x >= -0.5f && x <= 0.5f && z >= -0.5f && z <= 0.5f;
+		}
+
+		// unit disk in the xz plane
+		inline bool IntersectDisk(const Point3 & o, const Vec3 & d, float tMin, float tMax, float & t) {
+			t = -o.y / d.y;
+			if (!(t >= tMin && t <= tMax))
+				return false;
+
+			const float x = o.x + t * d.x;
+			const float z = o.z + t * d.z;
+			return x * x + z * z < 1.f;
+		}
+
+		// capsule of radius 1 along the y axis, the cylinder spans [-halfH, halfH]
+		inline bool IntersectCapsule(const Point3 & o, const Vec3 & d, float tMin, float tMax, float halfH, float & t) {
+			bool isHit = false;
+
+			// cylinder, both roots, the near one may lie above the caps
+			const float a = d.x * d.x + d.z * d.z;
+			const float b = d.x * o.x + d.z * o.z;
+			const float c = o.x * o.x + o.z * o.z - 1;
+			const float discriminant = b * b - a * c;
+			if (a != 0 && discriminant > 0) {
+				const float sqrt_discriminant = sqrt(discriminant);
+				const float roots[2] = { -(b + sqrt_discriminant) / a, (sqrt_discriminant - b) / a };
+				for (float root : roots) {
+					if (root < tMin || root > tMax)
+						continue;
+
+					const float y = o.y + root * d.y;
+					if (y > -halfH && y < halfH) {
+						tMax = t = root;
+						isHit = true;
+						break;
+					}
+				}
+			}
+			else if (a != 0 || c >= 0) {
+				// the ray misses the infinite cylinder, so it misses the caps too
+				return false;
+			}
+
+			// hemispheres, a root only counts on its own side of the cylinder
+			const float a_sphere = d.Dot(d);
+			for (int side = -1; side <= 1; side += 2) {
+				const Vec3 oc(o.x, o.y - side * halfH, o.z);
+				const float b_sphere = d.Dot(oc);
+				const float c_sphere = oc.Dot(oc) - 1;
+				const float discriminant_sphere = b_sphere * b_sphere - a_sphere * c_sphere;
+				if (discriminant_sphere < 0)
+					continue;
+
+				const float sqrt_discriminant = sqrt(discriminant_sphere);
+				const float roots[2] = { -(b_sphere + sqrt_discriminant) / a_sphere, (sqrt_discriminant - b_sphere) / a_sphere };
+				for (float root : roots) {
+					if (root < tMin || root > tMax)
+						continue;
+
+					const float y = o.y + root * d.y;
+					if (side * y >= halfH) {
+						tMax = t = root;
+						isHit = true;
+						break;
+					}
+				}
+			}
+
+			return isHit;
+		}
+
+		// analytic instances of the top level
+		inline bool IntersectAnalytic(const BVHAccel::Instance & instance, const Point3 & o, const Vec3 & d, float tMin, float tMax, float & t) {
+			switch (instance.type)
+			{
+			case BVHAccel::PrimType::Sphere:
+				return IntersectSphere(o, d, tMin, tMax, t);
+			case BVHAccel::PrimType::Plane:
+				return IntersectPlane(o, d, tMin, tMax, t);
+			case BVHAccel::PrimType::Disk:
+				return IntersectDisk(o, d, tMin, tMax, t);
+			case BVHAccel::PrimType::Capsule:
+				return IntersectCapsule(o, d, tMin, tMax, instance.halfHeight, t);
+			default:
+				return false;
+			}
+		}
+
+		// closest hit traversal of the subtree at rootIdx, near children first, no heap allocation
+		template<typename NodeT, typename LeafFunc>
+		void TraverseClosestLeaves(const NodeT * nodes, int rootIdx, const Point3 & o, const Vec3 & d, float tMin, float & tMax, LeafFunc & leafFunc) {
+			const Val3f invDir(1.f / d.x, 1.f / d.y, 1.f / d.z);
+			const int dirIsNeg[3] = { invDir.x < 0,invDir.y < 0,invDir.z < 0 };
+
+			// leaf child i of node k is pushed as -(k * BVH_WIDTH + i) - 1
+			struct StackEntry {
+				int idx;
+				float tNear;
+			};
+			StackEntry nodeStack[BVH_STACK_SIZE];
+			int stackSize = 0;
+			nodeStack[stackSize++] = { rootIdx, tMin };
+			while (stackSize > 0) {
+				const auto entry = nodeStack[--stackSize];
+
+				// a closer hit has been found
+				if (entry.tNear > tMax)
+					continue;
+
+				if (entry.idx < 0) {
+					const int leafIdx = -entry.idx - 1;
+					const auto & node = nodes[leafIdx / BVH_WIDTH];
+					leafFunc(node.GetShapesOffset(leafIdx % BVH_WIDTH), node.GetShapesNum(leafIdx % BVH_WIDTH), tMax);
+					continue;
+				}
+
+				const auto & node = nodes[entry.idx];
+				float tNear[BVH_WIDTH];
+				const int hitMask = node.Intersect(o, invDir, dirIsNeg, tMin, tMax, tNear);
+
+				// sort hit children from far to near, so the nearest one is popped first
+				StackEntry hits[BVH_WIDTH];
+				int hitNum = 0;
+				for (int i = 0; i < BVH_WIDTH; i++) {
+					if (!(hitMask & (1 << i)))
+						continue;
+
+					const StackEntry hit = { node.IsLeaf(i) ? -(entry.idx * BVH_WIDTH + i) - 1 : node.GetChildIdx(i), tNear[i] };
+					int j = hitNum++;
+					for (; j > 0 && hits[j - 1].tNear < hit.tNear; j--)
+						hits[j] = hits[j - 1];
+					hits[j] = hit;
+				}
+				for (int i = 0; i < hitNum; i++)
+					nodeStack[stackSize++] = hits[i];
+			}
+		}
+
+		// closest hit traversal of a tree, near children first, no heap allocation
+		// void leafFunc(int primOffset, int primNum, float & tMax) tests the primitives of a leaf
+		// and shortens tMax to the closest hit
+		template<typename LeafFunc>
+		void TraverseClosestLeaves(const BVHAccel::Tree & tree, const Point3 & o, const Vec3 & d, float tMin, float & tMax, LeafFunc leafFunc) {
+			if (tree.IsEmpty())
+				return;
+
+			if (tree.IsCompressed())
+				TraverseClosestLeaves(tree.GetCompressedNodes(), 0, o, d, tMin, tMax, leafFunc);
+			else
+				TraverseClosestLeaves(tree.GetWideNodes(), 0, o, d, tMin, tMax, leafFunc);
+		}
+
+		// closest hit traversal of a tree, near children first, no heap allocation
+		// bool primFunc(int primIdx, float tMax, float & t) tests one primitive of the leaves
+		// tMax is shortened to the closest hit
+		template<typename PrimFunc>
+		void TraverseClosest(const BVHAccel::Tree & tree, const Point3 & o, const Vec3 & d, float tMin, float & tMax, PrimFunc primFunc) {
+			TraverseClosestLeaves(tree, o, d, tMin, tMax, [&primFunc](int primOffset, int primNum, float & leafTMax) {
+				for (int primIdx = primOffset; primIdx < primOffset + primNum; primIdx++) {
+					float t;
+					if (primFunc(primIdx, leafTMax, t))
+						leafTMax = t;
+				}
+			});
+		}
+
+		// any hit traversal of the subtree at rootIdx, no heap allocation
+		template<typename NodeT, typename LeafFunc>
+		bool TraverseAnyLeaves(const NodeT * nodes, int rootIdx, const Point3 & o, const Vec3 & d, float tMin, float tMax, LeafFunc & leafFunc) {
+			const Val3f invDir(1.f / d.x, 1.f / d.y, 1.f / d.z);
+			const int dirIsNeg[3] = { invDir.x < 0,invDir.y < 0,invDir.z < 0 };
+
+			// leaf child i of node k is pushed as -(k * BVH_WIDTH + i) - 1
+			int nodeIdxStack[BVH_STACK_SIZE];
+			int stackSize = 0;
+			nodeIdxStack[stackSize++] = rootIdx;
+			while (stackSize > 0) {
+				const int nodeIdx = nodeIdxStack[--stackSize];
+
+				if (nodeIdx < 0) {
+					const int leafIdx = -nodeIdx - 1;
+					const auto & node = nodes[leafIdx / BVH_WIDTH];
+					if (leafFunc(node.GetShapesOffset(leafIdx % BVH_WIDTH), node.GetShapesNum(leafIdx % BVH_WIDTH)))
+						return true;
+					continue;
+				}
+
+				const auto & node = nodes[nodeIdx];
+				float tNear[BVH_WIDTH];
+				const int hitMask = node.Intersect(o, invDir, dirIsNeg, tMin, tMax, tNear);
+
+				// any hit ends the query, so the children are not sorted
+				for (int i = 0; i < BVH_WIDTH; i++) {
+					if (hitMask & (1 << i))
+						nodeIdxStack[stackSize++] = node.IsLeaf(i) ? -(nodeIdx * BVH_WIDTH + i) - 1 : node.GetChildIdx(i);
+				}
+			}
+			return false;
+		}
+
+		// any hit traversal of a tree, no heap allocation
+		// bool leafFunc(int primOffset, int primNum) tests the primitives of a leaf
+		template<typename LeafFunc>
+		bool TraverseAnyLeaves(const BVHAccel::Tree & tree, const Point3 & o, const Vec3 & d, float tMin, float tMax, LeafFunc leafFunc) {
+			if (tree.IsEmpty())
+				return false;
+
+			if (tree.IsCompressed())
+				return TraverseAnyLeaves(tree.GetCompressedNodes(), 0, o, d, tMin, tMax, leafFunc);
+			else
+				return TraverseAnyLeaves(tree.GetWideNodes(), 0, o, d, tMin, tMax, leafFunc);
+		}
+
+		// any hit traversal of a tree, no heap allocation
+		// bool primFunc(int primIdx) tests one primitive of the leaves
+		template<typename PrimFunc>
+		bool TraverseAny(const BVHAccel::Tree & tree, const Point3 & o, const Vec3 & d, float tMin, float tMax, PrimFunc primFunc) {
+			return TraverseAnyLeaves(tree, o, d, tMin, tMax, [&primFunc](int primOffset, int primNum) {
+				for (int primIdx = primOffset; primIdx < primOffset + primNum; primIdx++) {
+					if (primFunc(primIdx))
+						return true;
+				}
+				return false;
+			});
+		}
+
+		// rays traversed together, ray i of the packet keeps slot i in the local packets of instances
+		struct RayPacket {
+			void Set(int i, const Point3 & o, const Vec3 & d, float tMin, float tMax) {
+				this->o[i] = o;
+				this->d[i] = d;
+				invDir[i] = Val3f(1.f / d.x, 1.f / d.y, 1.f / d.z);
+				for (int axis = 0; axis < 3; axis++)
+					dirIsNeg[i][axis] = invDir[i][axis] < 0;
+				this->tMin[i] = tMin;
+				this->tMax[i] = tMax;
+			}
+
+			Point3 o[RAY_PACKET_SIZE];
+			Vec3 d[RAY_PACKET_SIZE];
+			Val3f invDir[RAY_PACKET_SIZE];
+			int dirIsNeg[RAY_PACKET_SIZE][3];
+			float tMin[RAY_PACKET_SIZE];
+			float tMax[RAY_PACKET_SIZE];
+		};
+
+		// stack entries with fewer active rays are finished ray by ray
+		// the rays have diverged, so sharing the node fetches no longer pays for the masks
+		constexpr int RAY_PACKET_MIN_ACTIVE = 3;
+
+		inline int BitCount(int mask) {
+			int num = 0;
+			for (; mask != 0; mask &= mask - 1)
+				num++;
+			return num;
+		}
+
+		// index of the lowest set bit, mask != 0
+		inline int LowestBit(int mask) {
+			int i = 0;
+			while (!(mask & (1 << i)))
+				i++;
+			return i;
+		}
+
+		// closest hit traversal of the active rays of a packet with a shared stack, no heap allocation
+		// each ray tests the children of a node with the SIMD slab test of the node
+		// a child is visited by the rays that hit it, nearest child of any ray first
+		template<typename NodeT, typename LeafFunc>
+		void TraverseClosestLeavesPacket(const NodeT * nodes, RayPacket & packet, int activeMask, LeafFunc & leafFunc) {
+			// leaf child i of node k is pushed as -(k * BVH_WIDTH + i) - 1
+			struct StackEntry {
+				int idx;
+				int rayMask;
+				float tNear; // min over the rays
+			};
+			StackEntry nodeStack[BVH_STACK_SIZE];
+			int stackSize = 0;
+			nodeStack[stackSize++] = { 0, activeMask, -std::numeric_limits<float>::infinity() };
+			while (stackSize > 0) {
+				const auto entry = nodeStack[--stackSize];
+
+				// drop the rays which have found a closer hit
+				int rayMask = 0;
+				for (int rays = entry.rayMask; rays != 0; rays &= rays - 1) {
+					const int i = LowestBit(rays);
+					if (entry.tNear <= packet.tMax[i])
+						rayMask |= 1 << i;
+				}
+				if (rayMask == 0)
+					continue;
+
+				if (entry.idx < 0) {
+					const int leafIdx = -entry.idx - 1;
+					const auto & node = nodes[leafIdx / BVH_WIDTH];
+					leafFunc(rayMask, node.GetShapesOffset(leafIdx % BVH_WIDTH), node.GetShapesNum(leafIdx % BVH_WIDTH));
+					continue;
+				}
+
+				// incoherent, single ray traversals of the subtree
+				if (BitCount(rayMask) < RAY_PACKET_MIN_ACTIVE) {
+					for (; rayMask != 0; rayMask &= rayMask - 1) {
+						const int i = LowestBit(rayMask);
+						// tMax is packet.tMax[i] itself, which leafFunc shortens
+						auto rayLeafFunc = [&leafFunc, i](int primOffset, int primNum, float & tMax) {
+							leafFunc(1 << i, primOffset, primNum);
+						};
+						TraverseClosestLeaves(nodes, entry.idx, packet.o[i], packet.d[i], packet.tMin[i], packet.tMax[i], rayLeafFunc);
+					}
+					continue;
+				}
+
+				const auto & node = nodes[entry.idx];
+				int childRayMasks[BVH_WIDTH] = { 0 };
+				float childTNears[BVH_WIDTH];
+				for (int c = 0; c < BVH_WIDTH; c++)
+					childTNears[c] = std::numeric_limits<float>::infinity();
+				for (int rays = rayMask; rays != 0; rays &= rays - 1) {
+					const int i = LowestBit(rays);
+					float tNear[BVH_WIDTH];
+					const int hitMask = node.Intersect(packet.o[i], packet.invDir[i], packet.dirIsNeg[i], packet.tMin[i], packet.tMax[i], tNear);
+					for (int c = 0; c < BVH_WIDTH; c++) {
+						if (!(hitMask & (1 << c)))
+							continue;
+
+						childRayMasks[c] |= 1 << i;
+						childTNears[c] = tNear[c] < childTNears[c] ? tNear[c] : childTNears[c];
+					}
+				}
+
+				// sort hit children from far to near, so the nearest one is popped first
+				StackEntry hits[BVH_WIDTH];
+				int hitNum = 0;
+				for (int c = 0; c < BVH_WIDTH; c++) {
+					if (childRayMasks[c] == 0)
+						continue;
+
+					const StackEntry hit = { node.IsLeaf(c) ? -(entry.idx * BVH_WIDTH + c) - 1 : node.GetChildIdx(c), childRayMasks[c], childTNears[c] };
+					int j = hitNum++;
+					for (; j > 0 && hits[j - 1].tNear < hit.tNear; j--)
+						hits[j] = hits[j - 1];
+					hits[j] = hit;
+				}
+				for (int c = 0; c < hitNum; c++)
+					nodeStack[stackSize++] = hits[c];
+			}
+		}
+
+		// closest hit traversal of the active rays of a packet, no heap allocation
+		// void leafFunc(int rayMask, int primOffset, int primNum) tests the primitives of a leaf
+		// against the rays in rayMask and shortens their packet.tMax to the closest hits
+		template<typename LeafFunc>
+		void TraverseClosestLeavesPacket(const BVHAccel::Tree & tree, RayPacket & packet, int activeMask, LeafFunc leafFunc) {
+			if (tree.IsEmpty() || activeMask == 0)
+				return;
+
+			if (tree.IsCompressed())
+				TraverseClosestLeavesPacket(tree.GetCompressedNodes(), packet, activeMask, leafFunc);
+			else
+				TraverseClosestLeavesPacket(tree.GetWideNodes(), packet, activeMask, leafFunc);
+		}
+
+		// any hit traversal of the active rays of a packet with a shared stack, no heap allocation
+		// return the mask of the occluded rays
+		template<typename NodeT, typename LeafFunc>
+		int TraverseAnyLeavesPacket(const NodeT * nodes, const RayPacket & packet, int activeMask, LeafFunc & leafFunc) {
+			// leaf child i of node k is pushed as -(k * BVH_WIDTH + i) - 1
+			struct StackEntry {
+				int idx;
+				int rayMask;
+			};
+			StackEntry nodeStack[BVH_STACK_SIZE];
+			int stackSize = 0;
+			nodeStack[stackSize++] = { 0, activeMask };
+			int occludedMask = 0;
+			while (stackSize > 0 && occludedMask != activeMask) {
+				const auto entry = nodeStack[--stackSize];
+
+				int rayMask = entry.rayMask & ~occludedMask;
+				if (rayMask == 0)
+					continue;
+
+				if (entry.idx < 0) {
+					const int leafIdx = -entry.idx - 1;
+					const auto & node = nodes[leafIdx / BVH_WIDTH];
+					occludedMask |= leafFunc(rayMask, node.GetShapesOffset(leafIdx % BVH_WIDTH), node.GetShapesNum(leafIdx % BVH_WIDTH));
+					continue;
+				}
+
+				// incoherent, single ray traversals of the subtree
+				if (BitCount(rayMask) < RAY_PACKET_MIN_ACTIVE) {
+					for (; rayMask != 0; rayMask &= rayMask - 1) {
+						const int i = LowestBit(rayMask);
+						auto rayLeafFunc = [&leafFunc, i](int primOffset, int primNum) {
+							return leafFunc(1 << i, primOffset, primNum) != 0;
+						};
+						if (TraverseAnyLeaves(nodes, entry.idx, packet.o[i], packet.d[i], packet.tMin[i], packet.tMax[i], rayLeafFunc))
+							occludedMask |= 1 << i;
+					}
+					continue;
+				}
+
+				const auto & node = nodes[entry.idx];
+				int childRayMasks[BVH_WIDTH] = { 0 };
+				for (int rays = rayMask; rays != 0; rays &= rays - 1) {
+					const int i = LowestBit(rays);
+					float tNear[BVH_WIDTH];
+					const int hitMask = node.Intersect(packet.o[i], packet.invDir[i], packet.dirIsNeg[i], packet.tMin[i], packet.tMax[i], tNear);
+					for (int c = 0; c < BVH_WIDTH; c++) {
+						if (hitMask & (1 << c))
+							childRayMasks[c] |= 1 << i;
+					}
+				}
+
+				// any hit ends the query of a ray, so the children are not sorted
+				for (int c = 0; c < BVH_WIDTH; c++) {
+					if (childRayMasks[c] != 0)
+						nodeStack[stackSize++] = { node.IsLeaf(c) ? -(entry.idx * BVH_WIDTH + c) - 1 : node.GetChildIdx(c), childRayMasks[c] };
+				}
+			}
+			return occludedMask;
+		}
+
+		// any hit traversal of the active rays of a packet, no heap allocation
+		// int leafFunc(int rayMask, int primOffset, int primNum) tests the primitives of a leaf
+		// against the rays in rayMask and returns the mask of the occluded ones
+		// return the mask of the occluded rays
+		template<typename LeafFunc>
+		int TraverseAnyLeavesPacket(const BVHAccel::Tree & tree, const RayPacket & packet, int activeMask, LeafFunc leafFunc) {
+			if (tree.IsEmpty() || activeMask == 0)
+				return 0;
+
+			if (tree.IsCompressed())
+				return TraverseAnyLeavesPacket(tree.GetCompressedNodes(), packet, activeMask, leafFunc);
+			else
+				return TraverseAnyLeavesPacket(tree.GetWideNodes(), packet, activeMask, leafFunc);
+		}
+	}
+}
+
+#endif//!_CPPUTIL_ENGINE_INTERSECTOR_INTERSECT_KERNEL_H_
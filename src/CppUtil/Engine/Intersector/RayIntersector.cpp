@@ -1,5 +1,7 @@
 #include <CppUtil/Engine/RayIntersector.h>
 
+#include "IntersectKernel.h"
+
 #include <CppUtil/Engine/SObj.h>
 #include <CppUtil/Engine/Ray.h>
 
@@ -18,13 +20,92 @@
 #include <CppUtil/Basic/Math.h>
 #include <CppUtil/Basic/UGM/Transform.h>
 
-#include <stack>
-
 using namespace CppUtil;
 using namespace CppUtil::Engine;
 using namespace CppUtil::Basic;
 using namespace std;
 
+namespace {
+	// attributes are in the local space of the mesh
+	void InterpolateTriangle(const TriMesh & mesh, int idx1, int idx2, int idx3, float u, float v, RayIntersector::Rst & rst) {
+		const float w = 1 - u - v;
+
+		// normal
+		const auto & normals = mesh.GetNormals();
+		const auto & n1 = normals[idx1];
+		const auto & n2 = normals[idx2];
+		const auto & n3 = normals[idx3];
+
+		rst.n = (w * n1 + u * n2 + v * n3).Normalize();
+
+		// texcoord
+		const auto & texcoords = mesh.GetTexcoords();
+		const auto & tc1 = texcoords[idx1];
+		const auto & tc2 = texcoords[idx2];
+		const auto & tc3 = texcoords[idx3];
+
+		rst.texcoord.x = w * tc1.x + u * tc2.x + v * tc3.x;
+		rst.texcoord.y = w * tc1.y + u * tc2.y + v * tc3.y;
+
+		// tangent
+		const auto & tangents = mesh.GetTangents();
+		const auto & tg1 = tangents[idx1];
+		const auto & tg2 = tangents[idx2];
+		const auto & tg3 = tangents[idx3];
+
+		rst.tangent = (w * tg1 + u * tg2 + v * tg3).Normalize();
+	}
+
+	// attributes of an analytic shape at pos, in its local space
+	void AnalyticAttributes(BVHAccel::PrimType type, float halfHeight, const Point3 & pos, RayIntersector::Rst & rst) {
+		switch (type)
+		{
+		case BVHAccel::PrimType::Sphere:
+			rst.n = pos;
+			rst.texcoord = Sphere::TexcoordOf(rst.n);
+			rst.tangent = Sphere::TangentOf(rst.n);
+			break;
+		case BVHAccel::PrimType::Plane:
+			rst.n = Normalf(0, 1, 0);
+			rst.texcoord = Point2(pos.x + 0.5f, pos.z + 0.5f);
+			rst.tangent = Normalf(1, 0, 0);
+			break;
+		case BVHAccel::PrimType::Disk:
+			rst.n = Normalf(0, 1, 0);
+			rst.texcoord = Point2((1 + pos.x) / 2, (1 + pos.z) / 2);
+			rst.tangent = Normalf(1, 0, 0);
+			break;
+		case BVHAccel::PrimType::Capsule:
+			if (pos.y > -halfHeight && pos.y < halfHeight)
+				rst.n = Normalf(pos.x, 0, pos.z);
+			else
+				rst.n = pos - Point3(0, pos.y > 0 ? halfHeight : -halfHeight, 0);
+			rst.texcoord = Sphere::TexcoordOf(Vec3f(pos));
+			rst.tangent = Sphere::TangentOf(Vec3f(pos));
+			break;
+		default:
+			break;
+		}
+	}
+
+	// attributes are computed once, for the closest hit only, ray.tMax is the hit
+	void ResolveHit(const BVHAccel & bvhAccel, const ERay & ray, int instanceIdx, int triIdx, float u, float v, RayIntersector::Rst & rst) {
+		const auto & instance = bvhAccel.GetInstance(instanceIdx);
+		if (instance.type == BVHAccel::PrimType::TriMesh) {
+			const int * idx = &instance.meshBVH->indice[3 * triIdx];
+			InterpolateTriangle(*instance.mesh, idx[0], idx[1], idx[2], u, v, rst);
+		}
+		else {
+			const Point3 localPos = instance.worldToLocal(ray.o) + ray.tMax * instance.worldToLocal(ray.d);
+			AnalyticAttributes(instance.type, instance.halfHeight, localPos, rst);
+		}
+
+		rst.closestSObj = instance.sobj.get();
+		rst.n = instance.localToWorld(rst.n).Normalize();
+		rst.tangent = instance.localToWorld(rst.tangent).Normalize();
+	}
+}
+
 RayIntersector::RayIntersector() {
 	RegMemberFunc<BVHAccel>(&RayIntersector::Visit);
 	RegMemberFunc<SObj>(&RayIntersector::Visit);
@@ -43,80 +124,124 @@ void RayIntersector::Init(ERay * ray) {
 	rst.isIntersect = false;
 }
 
-bool RayIntersector::Intersect(const BBoxf & bbox, const Val3f & invDir) const {
-	const auto & origin = ray->o;
-
-	float tMin = ray->tMin;
-	float tMax = ray->tMax;
-
-	for (int i = 0; i < 3; i++) {
-		float invD = invDir[i];
-		float t0 = (bbox.minP[i] - origin[i]) * invD;
-		float t1 = (bbox.maxP[i] - origin[i]) * invD;
-		if (invD < 0.0f)
-			swap(t0, t1);
+void RayIntersector::Visit(Ptr<BVHAccel> bvhAccel) {
+	Intersect(*bvhAccel);
+}
 
-		tMin = max(t0, tMin);
-		tMax = min(t1, tMax);
-		if (tMax < tMin)
-			return false;
-	}
+void RayIntersector::Intersect(const BVHAccel & bvhAccel) {
+	const Point3 origin = ray->o;
+	const Vec3 dir = ray->d;
+	int closestInstanceIdx = -1;
+	int closestTriIdx = -1;
+	float closestU = 0.f;
+	float closestV = 0.f;
+
+	// a hit is accepted only when closer than ray->tMax, so the closest* are always the latest hit
+	TraverseClosest(bvhAccel.GetTLAS(), origin, dir, ray->tMin, ray->tMax, [&](int instanceIdx, float tMax, float & t) {
+		// instances are intersected in local space, t is the same in both spaces
+		const auto & instance = bvhAccel.GetInstance(instanceIdx);
+		const Point3 localOrigin = instance.worldToLocal(origin);
+		const Vec3 localDir = instance.worldToLocal(dir);
+
+		if (instance.type != BVHAccel::PrimType::TriMesh) {
+			if (!IntersectAnalytic(instance, localOrigin, localDir, ray->tMin, tMax, t))
+				return false;
+
+			closestInstanceIdx = instanceIdx;
+			return true;
+		}
 
-	return true;
+		// only the barycentrics and the index of the closest triangle are kept
+		const auto & meshBVH = *instance.meshBVH;
+		bool isHit = false;
+		t = tMax;
+		TraverseClosestLeaves(meshBVH.tree, localOrigin, localDir, ray->tMin, t, [&](int triOffset, int triNum, float & triTMax) {
+			float triT, u, v;
+			int triIdx;
+			if (!IntersectLeafTriangles(meshBVH, localOrigin, localDir, ray->tMin, triTMax, triOffset, triNum, triT, u, v, triIdx))
+				return;
+
+			isHit = true;
+			triTMax = triT;
+			closestTriIdx = triIdx;
+			closestU = u;
+			closestV = v;
+		});
+
+		if (isHit)
+			closestInstanceIdx = instanceIdx;
+		return isHit;
+	});
+
+	if (closestInstanceIdx != -1)
+		ResolveHit(bvhAccel, *ray, closestInstanceIdx, closestTriIdx, closestU, closestV, rst);
 }
 
-void RayIntersector::Visit(Ptr<BVHAccel> bvhAccel) {
-	const auto visitor = This();
-
-	const auto origin = ray->o;
-	const auto dir = ray->d;
-	const auto invDir = ray->InvDir();
-	const bool dirIsNeg[3] = { invDir.x < 0,invDir.y < 0,invDir.z < 0 };
+void RayIntersector::IntersectPacket(const BVHAccel & bvhAccel, ERay * rays, const int num, Rst * rsts) {
+	RayPacket packet;
+	int closestInstanceIdx[RAY_PACKET_SIZE];
+	int closestTriIdx[RAY_PACKET_SIZE];
+	float closestU[RAY_PACKET_SIZE];
+	float closestV[RAY_PACKET_SIZE];
+	for (int i = 0; i < num; i++) {
+		packet.Set(i, rays[i].o, rays[i].d, rays[i].tMin, rays[i].tMax);
+		closestInstanceIdx[i] = -1;
+		rsts[i].closestSObj = nullptr;
+		rsts[i].isIntersect = false;
+	}
 
-	stack<int> nodeIdxStack;
-	nodeIdxStack.push(0);
-	while (!nodeIdxStack.empty()) {
-		const auto nodeIdx = nodeIdxStack.top();
-		nodeIdxStack.pop();
-		const auto & node = bvhAccel->GetBVHNode(nodeIdx);
+	// same as Intersect, ray by ray for the analytic instances and the leaves
+	RayPacket localPacket;
+	TraverseClosestLeavesPacket(bvhAccel.GetTLAS(), packet, (1 << num) - 1, [&](int rayMask, int instanceOffset, int instanceNum) {
+		for (int instanceIdx = instanceOffset; instanceIdx < instanceOffset + instanceNum; instanceIdx++) {
+			const auto & instance = bvhAccel.GetInstance(instanceIdx);
+			for (int rays = rayMask; rays != 0; rays &= rays - 1) {
+				const int i = LowestBit(rays);
+				localPacket.Set(i, instance.worldToLocal(packet.o[i]), instance.worldToLocal(packet.d[i]), packet.tMin[i], packet.tMax[i]);
+			}
 
-		if (!Intersect(node.GetBox(), invDir))
-			continue;
-		
-		if (node.IsLeaf()) {
-			for (auto shapeIdx : node.ShapesIdx()) {
-				const auto shape = bvhAccel->GetShape(shapeIdx);
-
-				bvhAccel->GetShapeW2LMat(shape).ApplyTo(*ray);
-				shape->Accept(visitor);
-				ray->o = origin;
-				ray->d = dir;
-
-				if (rst.isIntersect) {
-					rst.closestSObj = bvhAccel->GetSObj(shape);
-					rst.isIntersect = false;
+			if (instance.type != BVHAccel::PrimType::TriMesh) {
+				for (int rays = rayMask; rays != 0; rays &= rays - 1) {
+					const int i = LowestBit(rays);
+					float t;
+					if (IntersectAnalytic(instance, localPacket.o[i], localPacket.d[i], packet.tMin[i], packet.tMax[i], t)) {
+						packet.tMax[i] = t;
+						closestInstanceIdx[i] = instanceIdx;
+					}
 				}
+				continue;
 			}
-		}
-		else {
-			const auto firstChildIdx = BVHAccel::LinearBVHNode::FirstChildIdx(nodeIdx);
-			const auto secondChildIdx = node.GetSecondChildIdx();
-			if (dirIsNeg[node.GetAxis()]) {
-				nodeIdxStack.push(firstChildIdx);
-				nodeIdxStack.push(secondChildIdx);
-			}
-			else {
-				nodeIdxStack.push(secondChildIdx);
-				nodeIdxStack.push(firstChildIdx);
+
+			const auto & meshBVH = *instance.meshBVH;
+			TraverseClosestLeavesPacket(meshBVH.tree, localPacket, rayMask, [&](int leafRayMask, int triOffset, int triNum) {
+				for (int rays = leafRayMask; rays != 0; rays &= rays - 1) {
+					const int i = LowestBit(rays);
+					float t, u, v;
+					int triIdx;
+					if (!IntersectLeafTriangles(meshBVH, localPacket.o[i], localPacket.d[i], localPacket.tMin[i], localPacket.tMax[i], triOffset, triNum, t, u, v, triIdx))
+						continue;
+
+					localPacket.tMax[i] = t;
+					closestInstanceIdx[i] = instanceIdx;
+					closestTriIdx[i] = triIdx;
+					closestU[i] = u;
+					closestV[i] = v;
+				}
+			});
+
+			for (int rays = rayMask; rays != 0; rays &= rays - 1) {
+				const int i = LowestBit(rays);
+				packet.tMax[i] = localPacket.tMax[i];
 			}
 		}
-	}
+	});
 
-	if (rst.closestSObj) {
-		const Ptr<Shape> shape = rst.closestSObj->GetComponent<CmptGeometry>()->primitive;
-		const auto l2w = bvhAccel->GetShapeW2LMat(shape).Inverse();
-		rst.n = l2w(rst.n).Normalize();
-		rst.tangent = l2w(rst.tangent).Normalize();
+	for (int i = 0; i < num; i++) {
+		if (closestInstanceIdx[i] == -1)
+			continue;
+
+		rays[i].tMax = packet.tMax[i];
+		ResolveHit(bvhAccel, rays[i], closestInstanceIdx[i], closestTriIdx[i], closestU[i], closestV[i], rsts[i]);
 	}
 }
 
@@ -135,7 +260,7 @@ void RayIntersector::Visit(Ptr<SObj> sobj) {
 	if (geometry && geometry->primitive) {
 		geometry->primitive->Accept(This());
 		if (rst.isIntersect)
-			rst.closestSObj = sobj;
+			rst.closestSObj = sobj.get();
 	}
 
 	for (auto child : children)
@@ -151,60 +276,23 @@ void RayIntersector::Visit(Ptr<SObj> sobj) {
 }
 
 void RayIntersector::Visit(Ptr<Sphere> sphere) {
-	const auto & dir = ray->d;
-	const auto & origin = ray->o;
-
-	const Vec3 oc = origin;
-	const float a = dir.Dot(dir);
-	const float b = oc.Dot(dir);
-	const float c = oc.Dot(oc) - 1;
-	const float discriminant = b * b - a * c;
-
-	if (discriminant < 0) {
-		rst.isIntersect = false;
+	float t;
+	rst.isIntersect = IntersectSphere(ray->o, ray->d, ray->tMin, ray->tMax, t);
+	if (!rst.isIntersect)
 		return;
-	}
-
-	const float tMin = ray->tMin;
-	const float tMax = ray->tMax;
-	const float sqrt_discriminant = sqrt(discriminant);
-	const float inv_a = 1.0f / a;
-
-	float t = - (b + sqrt_discriminant) * inv_a;
-	if (t > tMax || t < tMin) {
-		t = (-b + sqrt_discriminant) * inv_a;
-		if (t > tMax || t < tMin) {
-			rst.isIntersect = false;
-			return;
-		}
-	}
 
-	rst.isIntersect = true;
 	ray->tMax = t;
-	rst.n = ray->At(t);
-	rst.texcoord = Sphere::TexcoordOf(rst.n);
-	rst.tangent = Sphere::TangentOf(rst.n);
+	AnalyticAttributes(BVHAccel::PrimType::Sphere, 0.f, ray->At(t), rst);
 }
 
 void RayIntersector::Visit(Ptr<Plane> plane) {
-	const float t = -ray->o.y / ray->d.y;
-	if (t<ray->tMin || t > ray->tMax) {
-		rst.isIntersect = false;
+	float t;
+	rst.isIntersect = IntersectPlane(ray->o, ray->d, ray->tMin, ray->tMax, t);
+	if (!rst.isIntersect)
 		return;
-	}
-
-	const auto pos = ray->At(t);
-	if (pos.x<-0.5 || pos.x>0.5 || pos.z<-0.5 || pos.z>0.5) {
-		rst.isIntersect = false;
-		return;
-	}
 
-	rst.isIntersect = true;
 	ray->tMax = t;
-	//rst.n = Normalf(0, -Math::sgn(ray->d.y), 0);
-	rst.n = Normalf(0, 1, 0);
-	rst.texcoord = Point2(pos.x + 0.5f, pos.z + 0.5f);
-	rst.tangent = Normalf(1, 0, 0);
+	AnalyticAttributes(BVHAccel::PrimType::Plane, 0.f, ray->At(t), rst);
 }
 
 void RayIntersector::Visit(Ptr<Triangle> triangle) {
@@ -214,86 +302,14 @@ void RayIntersector::Visit(Ptr<Triangle> triangle) {
 	const int idx3 = triangle->idx[2];
 
 	const auto & positions = mesh->GetPositions();
-	const auto & p1 = positions[idx1];
-	const auto & p2 = positions[idx2];
-	const auto & p3 = positions[idx3];
 
-	const auto & dir = ray->d;
-
-	const auto e1 = p2 - p1;
-	const auto e2 = p3 - p1;
-
-	const auto e1_x_d = e1.Cross(dir);
-	const float denominator = e1_x_d.Dot(e2);
-
-	if (denominator == 0) {
-		rst.isIntersect = false;
-		return;
-	}
-
-	const float inv_denominator = 1.0f / denominator;
-
-	const auto s = ray->o - p1;
-
-	const auto e2_x_s = e2.Cross(s);
-	const float r1 = e2_x_s.Dot(dir);
-	const float u = r1 * inv_denominator;
-	if (u < 0 || u > 1) {
-		rst.isIntersect = false;
+	float t, u, v;
+	rst.isIntersect = IntersectTriangle(ray->o, ray->d, ray->tMin, ray->tMax, positions[idx1], positions[idx2], positions[idx3], t, u, v);
+	if (!rst.isIntersect)
 		return;
-	}
-
-	const float r2 = e1_x_d.Dot(s);
-	const float v = r2 * inv_denominator;
-	if (v < 0 || v > 1) {
-		rst.isIntersect = false;
-		return;
-	}
-
-	const float u_plus_v = u + v;
-	if (u_plus_v > 1) {
-		rst.isIntersect = false;
-		return;
-	}
-
-	const float r3 = e2_x_s.Dot(e1);
-	const float t = r3 * inv_denominator;
-
-	if (t < ray->tMin || t > ray->tMax) {
-		rst.isIntersect = false;
-		return;
-	}
-
-	rst.isIntersect = true;
 
 	ray->tMax = t;
-
-	const float w = 1 - u_plus_v;
-
-	// normal
-	const auto & normals = mesh->GetNormals();
-	const auto & n1 = normals[idx1];
-	const auto & n2 = normals[idx2];
-	const auto & n3 = normals[idx3];
-
-	rst.n = (w * n1 + u * n2 + v * n3).Normalize();
-
-	// texcoord
-	const auto & texcoords = mesh->GetTexcoords();
-	const auto & tc1 = texcoords[idx1];
-	const auto & tc2 = texcoords[idx2];
-	const auto & tc3 = texcoords[idx3];
-
-	rst.texcoord.x = w * tc1.x + u * tc2.x + v * tc3.x;
-	rst.texcoord.y = w * tc1.y + u * tc2.y + v * tc3.y;
-
-	// tangent
-	const auto & tangents = mesh->GetTangents();
-	const auto & tg1 = tangents[idx1];
-	const auto & tg2 = tangents[idx2];
-	const auto & tg3 = tangents[idx3];
-
-	rst.tangent = (w * tg1 + u * tg2 + v * tg3).Normalize();
+	InterpolateTriangle(*mesh, idx1, idx2, idx3, u, v, rst);
 }
 
 void RayIntersector::Visit(Ptr<TriMesh> mesh) {
@@ -307,121 +323,21 @@ void RayIntersector::Visit(Ptr<TriMesh> mesh) {
 }
 
 void RayIntersector::Visit(Ptr<Disk> disk) {
-	const float t = -ray->o.y / ray->d.y;
-	if (t < ray->tMin || t > ray->tMax) {
-		rst.isIntersect = false;
+	float t;
+	rst.isIntersect = IntersectDisk(ray->o, ray->d, ray->tMin, ray->tMax, t);
+	if (!rst.isIntersect)
 		return;
-	}
 
-	const auto pos = ray->At(t);
-	if (Vec3f(pos).Norm2() >= 1.f) {
-		rst.isIntersect = false;
-		return;
-	}
-
-	rst.isIntersect = true;
 	ray->tMax = t;
-	//rst.n = Normalf(0, -Math::sgn(ray->d.y), 0);
-	rst.n = Normalf(0, 1, 0);
-	rst.texcoord = Point2((1+pos.x)/2, (1+pos.z)/2);
-	rst.tangent = Normalf(1, 0, 0);
+	AnalyticAttributes(BVHAccel::PrimType::Disk, 0.f, ray->At(t), rst);
 }
 
 void RayIntersector::Visit(Ptr<Capsule> capsule) {
-	const auto & o = ray->o;
-	const auto & d = ray->d;
-
-	float halfH = capsule->height / 2;
-
-	do{ // Բ
-		float a = d.x * d.x + d.z * d.z;
-		float b = d.x * o.x + d.z * o.z;
-		float c = o.x * o.x + o.z * o.z - 1;
-
-		float discriminant = b * b - a * c;
-		if (discriminant <= 0) {
-			rst.isIntersect = false;
-			return;
-		}
-
-		float sqrtDiscriminant = sqrt(discriminant);
-		float t = -(b + sqrtDiscriminant) / a;
-		if (t < ray->tMin || t > ray->tMax) {
-			t = (sqrtDiscriminant - b) / a;
-			if (t < ray->tMin || t > ray->tMax)
-				break;
-		}
-
-		auto pos = ray->At(t);
-		if (pos.y <= -halfH || pos.y >= halfH)
-			break;
-
-		rst.isIntersect = true;
-		ray->tMax = t;
-		rst.n = Normalf(pos.x, 0, pos.z);
-		rst.texcoord = Sphere::TexcoordOf(Vec3f(pos));
-		rst.tangent = Sphere::TangentOf(Vec3f(pos));
-		return;
-	} while (false);
-
-	float a = d.Dot(d);
-
-	do{// ϰ
-		Point3 center(0, halfH, 0);
-		auto oc = o - center;
-		float b = d.Dot(oc);
-		float c = oc.Norm2() - 1;
-
-		float discriminant = b * b - a * c;
-		if (discriminant <= 0)
-			break;
-
-		float sqrtDiscriminant = sqrt(discriminant);
-		float t = -(b + sqrtDiscriminant) / a;
-		auto pos = ray->At(t);
-		if (t < ray->tMin || t > ray->tMax || pos.y <= halfH) {
-			t = (sqrtDiscriminant - b) / a;
-			pos = ray->At(t);
-			if (t < ray->tMin || t > ray->tMax || pos.y <= halfH)
-				break;
-		}
-		
-		rst.isIntersect = true;
-		ray->tMax = t;
-		rst.n = pos - center;
-		rst.texcoord = Sphere::TexcoordOf(Vec3f(pos));
-		rst.tangent = Sphere::TangentOf(Vec3f(pos));
-		return;
-	} while (false);
-
-	do {// °
-		Point3 center(0, -halfH, 0);
-		auto oc = o - center;
-		float b = d.Dot(oc);
-		float c = oc.Norm2() - 1;
-
-		float discriminant = b * b - a * c;
-		if (discriminant <= 0)
-			break;
-
-		float sqrtDiscriminant = sqrt(discriminant);
-		float t = -(b + sqrtDiscriminant) / a;
-		auto pos = ray->At(t);
-		if (t < ray->tMin || t > ray->tMax || pos.y >= -halfH) {
-			t = (sqrtDiscriminant - b) / a;
-			pos = ray->At(t);
-			if (t < ray->tMin || t > ray->tMax || pos.y >= -halfH)
-				break;
-		}
-
-		rst.isIntersect = true;
-		ray->tMax = t;
-		rst.n = pos - center;
-		rst.texcoord = Sphere::TexcoordOf(Vec3f(pos));
-		rst.tangent = Sphere::TangentOf(Vec3f(pos));
+	float t;
+	rst.isIntersect = IntersectCapsule(ray->o, ray->d, ray->tMin, ray->tMax, capsule->height / 2, t);
+	if (!rst.isIntersect)
 		return;
-	} while (false);
 
-	rst.isIntersect = false;
-	return;
+	ray->tMax = t;
+	AnalyticAttributes(BVHAccel::PrimType::Capsule, capsule->height / 2, ray->At(t), rst);
 }
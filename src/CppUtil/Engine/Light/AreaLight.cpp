@@ -56,3 +56,13 @@ bool AreaLight::Hit(const Point3 & p, const Vec3 & dirToLight, Point3 & hitPos)
 
 	return true;
 }
+
+bool AreaLight::GetBounds(BBoxf & box, Normalf & axis, float & cosTheta_o, float & cosTheta_e, float & power) const {
+	// one sided, to +y
+	box = BBoxf(Point3(-width / 2, 0, -height / 2), Point3(width / 2, 0, height / 2));
+	axis = Normalf(0, 1, 0);
+	cosTheta_o = 1.f;
+	cosTheta_e = 0.f;
+	power = LuminancePower().Illumination();
+	return true;
+}
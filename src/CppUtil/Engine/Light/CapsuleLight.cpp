@@ -8,126 +8,167 @@ using namespace CppUtil::Basic;
 using namespace std;
 
 const RGBf CapsuleLight::Sample_L(const Point3 & p, Normalf & wi, float & distToLight, float & PD) const {
-	// ʱȼ򵥵ؾȲ
-	float sphereArea = 4 * Math::PI * radius * radius;
-	float cylinderArea = 2 * Math::PI * radius * height;
-	float wholeArea = sphereArea + cylinderArea;
-
-	Point3 pos;
-	Normalf normal;
-	if (Math::Rand_F() < sphereArea / wholeArea) {
-		// Sphere
-		pos = BasicSampler::UniformOnSphere();
-		normal = pos;
-		pos.y += pos.y >= 0 ? height / 2 : - height / 2;
+	// the capsule is convex, so the surface facing p is what p sees
+	float pSide, pUpper, pLower;
+	if (!ComponentP(p, pSide, pUpper, pLower)) {
+		PD = 0;
+		return RGBf(0);
 	}
-	else {
-		// Cylinder
-		auto posOnDisk = BasicSampler::UniformOnDisk();
-		auto y = (Math::Rand_F() - 0.5f) * height;
-		pos = Point3(posOnDisk[0], y, posOnDisk[1]);
-		normal = Normalf(posOnDisk.x, 0, posOnDisk.y);
-	}
-
-	auto d = pos - p;
-
-	auto dist2 = d.Dot(d);
 
-	distToLight = sqrt(dist2);
-
-	wi = d / distToLight;
+	const float halfH = height / 2;
+	const float Xi = Math::Rand_F();
+	if (Xi < pSide) {
+		// side, uniform in the area of the half facing p
+		const float rho = sqrt(p.x * p.x + p.z * p.z);
+		const float phi = atan2(p.z, p.x) + (2 * Math::Rand_F() - 1) * acos(radius / rho);
+		const Normalf normal(cos(phi), 0, sin(phi));
+		const Point3 pos(radius * normal.x, (Math::Rand_F() - 0.5f) * height, radius * normal.z);
+
+		const auto d = pos - p;
+		const float dist2 = d.Norm2();
+		distToLight = sqrt(dist2);
+		wi = d / distToLight;
+
+		const float cosTheta = (-wi).Dot(normal);
+		if (cosTheta <= 0) {
+			PD = 0;
+			return RGBf(0);
+		}
+
+		PD = pSide * dist2 / (SideAreaFacing(p) * cosTheta);
+		return Luminance();
+	}
 
-	float cosTheta = (-wi).Dot(normal);
-	PD = dist2 / (wholeArea * Math::Abs(cosTheta));
+	// cap, uniform in the cone of its sphere
+	// the directions reaching the half of the sphere inside the capsule hit the side first, they are dropped
+	const bool isUpper = Xi < pSide + pUpper;
+	const Point3 center(0, isUpper ? halfH : -halfH, 0);
+	const auto toCenter = center - p;
+	const float dist2 = toCenter.Norm2();
+	const float dist = sqrt(dist2);
+	const float sin2ThetaMax = radius * radius / dist2;
+	const auto dirInCone = BasicSampler::UniformInCone(sin2ThetaMax);
+
+	wi = (Normalf(toCenter / dist).GenCoordSpace() * Normalf(dirInCone)).Normalize();
+
+	const float sin2Theta = dirInCone.x * dirInCone.x + dirInCone.y * dirInCone.y;
+	distToLight = dist * dirInCone.z - sqrt(max(0.f, radius * radius - dist2 * sin2Theta));
+
+	const float y = p.y + distToLight * wi.y;
+	if (isUpper ? y < halfH : y > -halfH) {
+		PD = 0;
+		return RGBf(0);
+	}
 
-	return cosTheta < 0 ? RGBf(0) : Luminance();
+	PD = (isUpper ? pUpper : pLower) * BasicSampler::PDofUniformInCone(sin2ThetaMax);
+	return Luminance();
 }
 
 float CapsuleLight::PDF(const Point3 & p, const Normalf & wi) const {
-	float halfH = height / 2;
-	float sphereArea = 4 * Math::PI * radius * radius;
-	float cylinderArea = 2 * Math::PI * radius * height;
-	float wholeArea = sphereArea + cylinderArea;
+	float pSide, pUpper, pLower;
+	if (!ComponentP(p, pSide, pUpper, pLower))
+		return 0;
+
+	const float halfH = height / 2;
+	const float radius2 = radius * radius;
 
 	do { // Բ
+		// only a ray from out of the infinite cylinder reaches the side
+		const float rho2 = p.x * p.x + p.z * p.z;
+		if (rho2 <= radius2)
+			break;
+
 		float a = wi.x * wi.x + wi.z * wi.z;
 		float b = wi.x * p.x + wi.z * p.z;
-		float c = p.x * p.x + p.z * p.z - radius * radius;
+		float c = rho2 - radius2;
 
 		float discriminant = b * b - a * c;
-		if (discriminant <= 0)
-			return 0; // 
-
-		float sqrtDiscriminant = sqrt(discriminant);
-		float t = -(b + sqrtDiscriminant) / a;
-		if (t < 0)
-			return 0; // ཻ
+		if (a == 0 || b >= 0 || discriminant <= 0)
+			return 0; // ⣬Ҳ
 
+		float t = -(b + sqrt(discriminant)) / a;
 		auto pos = p + t * Vec3(wi);
 		if (pos.y <= -halfH || pos.y >= halfH)
 			break; // Բཻ
 
-		float dist2 = p.Distance2With(pos);
-		auto normal = Vec3(pos.x, 0, pos.y) / radius;
+		const Normalf normal = Vec3(pos.x, 0, pos.z) / radius;
+		float cosTheta = (-wi).Dot(normal);
+		if (cosTheta <= 0)
+			return 0;
 
-		float cosTheta = normal.Dot(p-pos) / sqrt(dist2); // positive
-		return dist2 / (wholeArea * cosTheta);
+		return pSide * t * t / (SideAreaFacing(p) * cosTheta);
 	} while (false);
 
-	//float a = wi.Dot(wi);
-	float a = 1.f;
-
-	do {// ϰ
-		Point3 center(0, halfH, 0);
+	// ϰ°
+	for (int i = 0; i < 2; i++) {
+		const bool isUpper = i == 0;
+		Point3 center(0, isUpper ? halfH : -halfH, 0);
 		auto oc = p - center;
+		float dist2 = oc.Norm2();
 		float b = wi.Dot(oc);
-		float c = oc.Norm2() - radius * radius;
-
-		float discriminant = b * b - a * c;
-		if (discriminant <= 0)
-			break;
+		float discriminant = b * b - (dist2 - radius2);
+		if (b >= 0 || discriminant <= 0)
+			continue;
 
-		float sqrtDiscriminant = sqrt(discriminant);
-		float t = -(b + sqrtDiscriminant) / a;
-		auto pos = p + t * Vec3(wi);
-		if (t < 0)
-			break;
+		float t = -(b + sqrt(discriminant));
+		float y = p.y + t * wi.y;
+		if (isUpper ? y < halfH : y > -halfH)
+			continue;
 
-		if (pos.y <= halfH)
-			break;
+		return (isUpper ? pUpper : pLower) * BasicSampler::PDofUniformInCone(radius2 / dist2);
+	}
 
-		auto normal = (pos - center) / radius;
-		float dist2 = pos.Distance2With(p);
-		float cosTheta = normal.Dot(p - pos) / sqrt(dist2); // positive
-		
-		return dist2 / (wholeArea * cosTheta);
-	} while (false);
+	return 0;
+}
 
-	do {// °
-		Point3 center(0, -halfH, 0);
-		auto oc = p - center;
-		float b = wi.Dot(oc);
-		float c = oc.Norm2() - radius * radius;
+bool CapsuleLight::ComponentP(const Point3 & p, float & pSide, float & pUpper, float & pLower) const {
+	const float halfH = height / 2;
+	const float radius2 = radius * radius;
+	const float rho2 = p.x * p.x + p.z * p.z;
+
+	// inside if closer to the axis segment than radius
+	const float dy = max(0.f, Math::Abs(p.y) - halfH);
+	if (rho2 + dy * dy <= radius2)
+		return false;
+
+	// the side by its projected area, at most a hemisphere
+	float side = 0.f;
+	if (rho2 > radius2) {
+		const float dist = Vec3f(p).Norm();
+		side = min(2 * Math::PI, 2 * radius * height * sqrt(rho2) / (dist * dist * dist));
+	}
 
-		float discriminant = b * b - a * c;
-		if (discriminant <= 0)
-			break;
+	// a cap by the cone of its sphere, the part of it the cap takes is about 1 from the pole, 1/2 from the side
+	float caps[2];
+	for (int i = 0; i < 2; i++) {
+		const float sign = i == 0 ? 1.f : -1.f;
+		const auto oc = p - Point3(0, sign * halfH, 0);
+		const float dist2 = oc.Norm2();
+		const float cosPhi = sign * oc.y / sqrt(dist2);
+		caps[i] = (1 + cosPhi) / 2 / BasicSampler::PDofUniformInCone(radius2 / dist2);
+	}
 
-		float sqrtDiscriminant = sqrt(discriminant);
-		float t = -(b + sqrtDiscriminant) / a;
-		auto pos = p + t * Vec3(wi);
-		if (t < 0)
-			break;
-		
-		if (pos.y >= -halfH)
-			break;
+	const float sum = side + caps[0] + caps[1];
+	if (sum <= 0)
+		return false;
 
-		auto normal = (pos - center) / radius;
-		float dist2 = pos.Distance2With(p);
-		float cosTheta = normal.Dot(p - pos) / sqrt(dist2); // positive
+	pSide = side / sum;
+	pUpper = caps[0] / sum;
+	pLower = caps[1] / sum;
+	return true;
+}
 
-		return dist2 / (wholeArea * cosTheta);
-	} while (false);
+float CapsuleLight::SideAreaFacing(const Point3 & p) const {
+	// the normals within acos(r / rho) of the direction to p
+	const float rho = sqrt(p.x * p.x + p.z * p.z);
+	return 2 * acos(radius / rho) * radius * height;
+}
 
-	return 0;
+bool CapsuleLight::GetBounds(BBoxf & box, Normalf & axis, float & cosTheta_o, float & cosTheta_e, float & power) const {
+	box = BBoxf(Point3(-radius, -height / 2 - radius, -radius), Point3(radius, height / 2 + radius, radius));
+	axis = Normalf(0, 1, 0);
+	cosTheta_o = -1.f;
+	cosTheta_e = 0.f;
+	power = LuminancePower().Illumination();
+	return true;
 }
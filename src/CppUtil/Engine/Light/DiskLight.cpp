@@ -41,3 +41,13 @@ float DiskLight::PDF(const Point3 & p, const Normalf & wi) const {
 	float dist2 = (p - pos).Norm2();
 	return dist2 / (Math::PI * r2 * (-wi.y));
 }
+
+bool DiskLight::GetBounds(BBoxf & box, Normalf & axis, float & cosTheta_o, float & cosTheta_e, float & power) const {
+	// one sided, to +y
+	box = BBoxf(Point3(-radius, 0, -radius), Point3(radius, 0, radius));
+	axis = Normalf(0, 1, 0);
+	cosTheta_o = 1.f;
+	cosTheta_e = 0.f;
+	power = LuminancePower().Illumination();
+	return true;
+}
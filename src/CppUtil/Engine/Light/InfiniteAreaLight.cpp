@@ -10,7 +10,7 @@ using namespace CppUtil::Engine;
 using namespace std;
 
 void InfiniteAreaLight::SetImg(Ptr<Image> img) {
-	aliasMethod.Clear();
+	distribution.Clear();
 	this->img = img;
 
 	if (!img)
@@ -22,23 +22,15 @@ void InfiniteAreaLight::SetImg(Ptr<Image> img) {
 		return;
 	}
 
-	auto w = img->GetWidth();
-	auto h = img->GetHeight();
-	vector<double> distribution(w*h);
-	double sum = 0.f;
-	for (int y = 0; y < h; y++) {
-		double sinTheta = sin(Math::PI * (y + 0.5) / static_cast<double>(h));
-		for (int x = 0; x < w; x++) {
-			int idx = img->xy2idx(x, y);
-			distribution[idx] = sinTheta * img->GetPixel(x, y).ToRGB().Illumination();
-			sum += distribution[idx];
-		}
-	}
-
-	for (auto & p : distribution)
-		p /= sum;
-
-	aliasMethod.Init(distribution);
+	const int w = img->GetWidth();
+	const int h = img->GetHeight();
+	const float * data = img->GetData();
+	distribution.Init(w, h, [=](int y, float * row) {
+		const float sinTheta = sin(Math::PI * (y + 0.5f) / h);
+		const float * pixel = data + static_cast<size_t>(img->xy2idx(0, y)) * 3;
+		for (int x = 0; x < w; x++, pixel += 3)
+			row[x] = sinTheta * RGBf(pixel[0], pixel[1], pixel[2]).Illumination();
+	});
 }
 
 const RGBf InfiniteAreaLight::Sample_L(const Point3 & p, Normalf & wi, float & distToLight, float & PD) const {
@@ -49,23 +41,21 @@ const RGBf InfiniteAreaLight::Sample_L(const Point3 & p, Normalf & wi, float & d
 		return intensity * colorFactor;
 	}
 
-	const auto w = img->GetWidth();
-	const auto h = img->GetHeight();
+	float p_uv;
+	const auto texcoord = distribution.Sample(Math::Rand_F(), Math::Rand_F(), p_uv);
 
-	double pOfPixel;
-	int idx = aliasMethod.Sample(pOfPixel); // x + y * w, 0 <= x < w
-	auto xy = img->idx2xy(idx);
-
-	float u = (xy.x + Math::Rand_F()) / w;
-	float v = (xy.y + Math::Rand_F()) / h;
-
-	auto sphereCoord = Sphere::SphereCoord({ u,v });
+	auto sphereCoord = Sphere::SphereCoord(texcoord);
 	wi = sphereCoord.ToDir();
 
-	auto p_uv = static_cast<float>(pOfPixel * w * h);
-	PD = p_uv / (2.f * Math::PI * Math::PI * std::sin(sphereCoord.theta));
+	const float sinTheta = std::sin(sphereCoord.theta);
+	if (sinTheta == 0) {
+		PD = 0;
+		return RGBf(0.f);
+	}
+
+	PD = p_uv / (2.f * Math::PI * Math::PI * sinTheta);
 
-	return GetColor({ u,v });
+	return GetColor(texcoord);
 }
 
 float InfiniteAreaLight::PDF(const Point3 & p, const Normalf & wi) const {
@@ -76,17 +66,11 @@ float InfiniteAreaLight::PDF(const Point3 & p, const Normalf & wi) const {
 	auto texcoord = Sphere::TexcoordOf(wi);
 	auto sphereCoord = Sphere::SphereCoord(texcoord);
 
-	int w = img->GetWidth();
-	int h = img->GetHeight();
-
-	auto x = Math::Clamp(static_cast<int>(texcoord.x * w), 0, w-1);
-	auto y = Math::Clamp(static_cast<int>(texcoord.y * h), 0, h-1);
-
-	int idx = img->xy2idx(x, y);
+	const float sinTheta = std::sin(sphereCoord.theta);
+	if (sinTheta == 0)
+		return 0;
 
-	auto pOfPixel = aliasMethod.P(idx);
-	auto p_uv = static_cast<float>(pOfPixel * w * h);
-	return p_uv / (2.f * Math::PI * Math::PI * std::sin(sphereCoord.theta));
+	return distribution.PDF(texcoord) / (2.f * Math::PI * Math::PI * sinTheta);
 }
 
 const RGBf InfiniteAreaLight::Le(const ERay & ray) const {
@@ -0,0 +1,406 @@
+#include <CppUtil/Engine/LightSampler.h>
+
+#include <CppUtil/Engine/Light.h>
+
+#include <CppUtil/Basic/Math.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace CppUtil;
+using namespace CppUtil::Engine;
+using namespace CppUtil::Basic;
+using namespace std;
+
+namespace {
+	// the largest float below 1
+	constexpr float ONE_MINUS_EPSILON = 0.99999994f;
+
+	// a node pushes at most 2 children, and the tree is at most 64 deep
+	constexpr int LIGHT_BVH_STACK_SIZE = 128;
+
+	float SafeSqrt(float x) {
+		return sqrt(max(x, 0.f));
+	}
+
+	// cos(max(0, a - b)), from the sines and cosines of a and b in [0, pi]
+	float CosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+		if (cosA > cosB)
+			return 1.f;
+		return cosA * cosB + sinA * sinB;
+	}
+
+	// sin(max(0, a - b))
+	float SinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+		if (cosA > cosB)
+			return 0.f;
+		return sinA * cosB - cosA * sinB;
+	}
+
+	// rotates v by theta around the unit axis k, Rodrigues' formula
+	const Vec3 Rotate(const Vec3 & v, const Vec3 & k, float theta) {
+		const float cosTheta = cos(theta);
+		const float sinTheta = sin(theta);
+		return v * cosTheta + k.Cross(v) * sinTheta + k * (k.Dot(v) * (1 - cosTheta));
+	}
+
+	// the smallest cone around both cones of directions, cone (axis, cosTheta) is within acos(cosTheta) of axis
+	void UnionCone(const Vec3 & axisA, float cosA, const Vec3 & axisB, float cosB, Vec3 & axis, float & cosTheta) {
+		const float thetaA = acos(Math::Clamp(cosA, -1.f, 1.f));
+		const float thetaB = acos(Math::Clamp(cosB, -1.f, 1.f));
+		const float thetaD = acos(Math::Clamp(axisA.Dot(axisB), -1.f, 1.f));
+
+		// one cone is within the other
+		if (min(thetaD + thetaB, Math::PI) <= thetaA) {
+			axis = axisA;
+			cosTheta = cosA;
+			return;
+		}
+		if (min(thetaD + thetaA, Math::PI) <= thetaB) {
+			axis = axisB;
+			cosTheta = cosB;
+			return;
+		}
+
+		const float thetaO = (thetaA + thetaD + thetaB) / 2;
+		const Vec3 rotAxis = axisA.Cross(axisB);
+		if (thetaO >= Math::PI || rotAxis.Norm2() == 0) {
+			axis = axisA;
+			cosTheta = -1.f;
+			return;
+		}
+
+		// the axis turns from axisA toward axisB
+		axis = Rotate(axisA, rotAxis.Normalize(), thetaO - thetaA).Normalize();
+		cosTheta = cos(thetaO);
+	}
+
+	// whether the ray from p along the direction of invDir reaches box
+	bool IsHit(const BBoxf & box, const Point3 & p, const float invDir[3]) {
+		float t0 = 0.f;
+		float t1 = FLT_MAX;
+		for (int axis = 0; axis < 3; axis++) {
+			float tNear = (box.minP[axis] - p[axis]) * invDir[axis];
+			float tFar = (box.maxP[axis] - p[axis]) * invDir[axis];
+			if (tNear > tFar)
+				swap(tNear, tFar);
+			// a bit wider, for the flat boxes of disks and rectangles
+			tFar *= 1.0001f;
+
+			// NaN (0 * inf) keeps the bounds
+			t0 = tNear > t0 ? tNear : t0;
+			t1 = tFar < t1 ? tFar : t1;
+			if (t0 > t1)
+				return false;
+		}
+		return true;
+	}
+}
+
+const LightSampler::LightBounds LightSampler::LightBounds::Union(const LightBounds & rhs) const {
+	if (power == 0)
+		return rhs;
+	if (rhs.power == 0)
+		return *this;
+
+	LightBounds rst;
+	rst.box = box.Union(rhs.box);
+	UnionCone(axis, cosTheta_o, rhs.axis, rhs.cosTheta_o, rst.axis, rst.cosTheta_o);
+	rst.cosTheta_e = min(cosTheta_e, rhs.cosTheta_e);
+	rst.power = power + rhs.power;
+	return rst;
+}
+
+float LightSampler::LightBounds::Importance(const Point3 & p) const {
+	if (power == 0)
+		return 0.f;
+
+	// close to the bounds, the distance is clamped to their size
+	const Point3 center = box.Center();
+	const float radius = box.Diagonal().Norm() / 2;
+	const float dist2 = p.Distance2With(center);
+	const float d2 = max({ dist2, radius, FLT_MIN });
+
+	// angle between the axis and the direction from the bounds to p
+	const Vec3 w = p - center;
+	const float dist = sqrt(dist2);
+	const float cosTheta_w = dist > 0 ? Math::Clamp(axis.Dot(w) / dist, -1.f, 1.f) : 1.f;
+	const float sinTheta_w = SafeSqrt(1 - cosTheta_w * cosTheta_w);
+
+	// the bounds seen from p are within theta_b
+	const float cosTheta_b = dist2 < radius * radius ? -1.f : SafeSqrt(1 - radius * radius / dist2);
+	const float sinTheta_b = SafeSqrt(1 - cosTheta_b * cosTheta_b);
+
+	// the smallest angle between a normal of the emitters and a direction to p
+	const float sinTheta_o = SafeSqrt(1 - cosTheta_o * cosTheta_o);
+	const float cosTheta_x = CosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+	const float sinTheta_x = SinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+	const float cosThetap = CosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+	if (cosThetap <= cosTheta_e)
+		return 0.f;
+
+	return power * cosThetap / d2;
+}
+
+void LightSampler::Init(const vector<Ptr<Light>> & lights, const vector<Transform> & lightToWorldVec, const vector<Transform> & worldToLightVec) {
+	this->lights = lights;
+	this->worldToLightVec = worldToLightVec;
+
+	const int lightNum = static_cast<int>(lights.size());
+	unboundedLights.clear();
+	isBounded.assign(lightNum, false);
+	nodes.clear();
+	lightToBitTrail.assign(lightNum, 0);
+	powerTable.Clear();
+	powerTableLights.clear();
+	lightToPowerTableIdx.assign(lightNum, -1);
+
+	vector<int> boundedLights;
+	vector<LightBounds> lightBounds(lightNum);
+	for (int i = 0; i < lightNum; i++) {
+		BBoxf box;
+		Normalf axis;
+		float cosTheta_o;
+		float cosTheta_e;
+		float power;
+		if (!lights[i]->GetBounds(box, axis, cosTheta_o, cosTheta_e, power)) {
+			unboundedLights.push_back(i);
+			continue;
+		}
+
+		auto & bounds = lightBounds[i];
+		bounds.box = lightToWorldVec[i](box);
+		bounds.axis = Vec3(lightToWorldVec[i](axis)).Normalize();
+		bounds.cosTheta_o = cosTheta_o;
+		bounds.cosTheta_e = cosTheta_e;
+		bounds.power = max(power, 0.f);
+
+		isBounded[i] = true;
+		boundedLights.push_back(i);
+	}
+
+	if (boundedLights.empty())
+		return;
+
+	Build(boundedLights, lightBounds, 0, static_cast<int>(boundedLights.size()), 0, 0);
+
+	// lights without power are never picked, unless all are so
+	double powerSum = 0.0;
+	for (int lightID : boundedLights)
+		powerSum += lightBounds[lightID].power;
+
+	vector<double> distribution;
+	for (int lightID : boundedLights) {
+		lightToPowerTableIdx[lightID] = static_cast<int>(powerTableLights.size());
+		powerTableLights.push_back(lightID);
+		distribution.push_back(powerSum > 0 ? lightBounds[lightID].power / powerSum : 1.0 / boundedLights.size());
+	}
+	powerTable.Init(distribution);
+}
+
+int LightSampler::Build(vector<int> & boundedLights, vector<LightBounds> & lightBounds, int first, int num, int depth, uint64_t bitTrail) {
+	const int nodeIdx = static_cast<int>(nodes.size());
+	nodes.push_back(Node());
+
+	if (num == 1) {
+		const int lightID = boundedLights[first];
+		nodes[nodeIdx].bounds = lightBounds[lightID];
+		nodes[nodeIdx].secondChild = -1;
+		nodes[nodeIdx].lightID = lightID;
+		lightToBitTrail[lightID] = bitTrail;
+		return nodeIdx;
+	}
+
+	// the median split halves the lights, so the depth stays below 64
+	BBoxf centerBox;
+	for (int i = first; i < first + num; i++)
+		centerBox.UnionWith(lightBounds[boundedLights[i]].box.Center());
+	const int axis = centerBox.MaxExtent();
+
+	const int mid = first + num / 2;
+	nth_element(boundedLights.begin() + first, boundedLights.begin() + mid, boundedLights.begin() + first + num,
+		[&](int lhs, int rhs) {
+		return lightBounds[lhs].box.Center()[axis] < lightBounds[rhs].box.Center()[axis];
+	});
+
+	Build(boundedLights, lightBounds, first, mid - first, depth + 1, bitTrail);
+	const int secondChild = Build(boundedLights, lightBounds, mid, first + num - mid, depth + 1, bitTrail | (static_cast<uint64_t>(1) << depth));
+
+	nodes[nodeIdx].bounds = nodes[nodeIdx + 1].bounds.Union(nodes[secondChild].bounds);
+	nodes[nodeIdx].secondChild = secondChild;
+	nodes[nodeIdx].lightID = -1;
+	return nodeIdx;
+}
+
+float LightSampler::BoundedP() const {
+	if (nodes.empty())
+		return 0.f;
+
+	return 1.f / (unboundedLights.size() + 1);
+}
+
+bool LightSampler::ChildrenP(const Point3 & p, int nodeIdx, float & p0, float & p1) const {
+	const float importance0 = nodes[nodeIdx + 1].bounds.Importance(p);
+	const float importance1 = nodes[nodes[nodeIdx].secondChild].bounds.Importance(p);
+	const float sum = importance0 + importance1;
+	if (sum == 0)
+		return false;
+
+	p0 = importance0 / sum;
+	p1 = importance1 / sum;
+	return true;
+}
+
+int LightSampler::Sample(const Point3 & p, float u, float & pmf) const {
+	pmf = 0.f;
+	const int lightNum = static_cast<int>(lights.size());
+	if (lightNum == 0)
+		return -1;
+
+	if (mode == Mode::Uniform) {
+		pmf = 1.f / lightNum;
+		return min(static_cast<int>(u * lightNum), lightNum - 1);
+	}
+
+	// the lower part of [0, 1) goes to the bounded lights
+	const float pBounded = BoundedP();
+	if (u >= pBounded) {
+		const int unboundedNum = static_cast<int>(unboundedLights.size());
+		const float uUnbounded = (u - pBounded) / (1 - pBounded);
+		pmf = (1 - pBounded) / unboundedNum;
+		return unboundedLights[min(static_cast<int>(uUnbounded * unboundedNum), unboundedNum - 1)];
+	}
+	u = min(u / pBounded, ONE_MINUS_EPSILON);
+
+	if (mode == Mode::Power) {
+		double p;
+		const int idx = powerTable.Sample(u, p);
+		pmf = static_cast<float>(pBounded * p);
+		return powerTableLights[idx];
+	}
+
+	// down the light BVH, each child by its importance
+	if (nodes[0].bounds.Importance(p) == 0)
+		return -1;
+
+	float curPmf = pBounded;
+	int nodeIdx = 0;
+	while (nodes[nodeIdx].lightID == -1) {
+		float p0, p1;
+		if (!ChildrenP(p, nodeIdx, p0, p1))
+			return -1;
+
+		if (u < p0) {
+			u = min(u / p0, ONE_MINUS_EPSILON);
+			curPmf *= p0;
+			nodeIdx = nodeIdx + 1;
+		}
+		else {
+			u = min((u - p0) / p1, ONE_MINUS_EPSILON);
+			curPmf *= p1;
+			nodeIdx = nodes[nodeIdx].secondChild;
+		}
+	}
+
+	pmf = curPmf;
+	return nodes[nodeIdx].lightID;
+}
+
+float LightSampler::PMF(const Point3 & p, int lightID) const {
+	const int lightNum = static_cast<int>(lights.size());
+	if (mode == Mode::Uniform)
+		return 1.f / lightNum;
+
+	const float pBounded = BoundedP();
+	if (!isBounded[lightID])
+		return (1 - pBounded) / unboundedLights.size();
+
+	if (mode == Mode::Power)
+		return static_cast<float>(pBounded * powerTable.P(lightToPowerTableIdx[lightID]));
+
+	// the path of the light from the root, O(log(lightNum))
+	if (nodes[0].bounds.Importance(p) == 0)
+		return 0.f;
+
+	float pmf = pBounded;
+	uint64_t bitTrail = lightToBitTrail[lightID];
+	int nodeIdx = 0;
+	while (nodes[nodeIdx].lightID == -1) {
+		float p0, p1;
+		if (!ChildrenP(p, nodeIdx, p0, p1))
+			return 0.f;
+
+		if (bitTrail & 1) {
+			pmf *= p1;
+			nodeIdx = nodes[nodeIdx].secondChild;
+		}
+		else {
+			pmf *= p0;
+			nodeIdx = nodeIdx + 1;
+		}
+		bitTrail >>= 1;
+	}
+
+	return pmf;
+}
+
+float LightSampler::LightPDF(int lightID, const Point3 & p, const Normalf & dir) const {
+	const auto & worldToLight = worldToLightVec[lightID];
+	return lights[lightID]->PDF(worldToLight(p), worldToLight(dir).Normalize());
+}
+
+float LightSampler::PDF(const Point3 & p, const Normalf & dir, int skipLightID, bool isWeighted) const {
+	float sum = 0.f;
+	auto addLight = [&](int lightID, float weight) {
+		if (lightID == skipLightID || weight == 0 || lights[lightID]->IsDelta())
+			return;
+		sum += weight * LightPDF(lightID, p, dir);
+	};
+
+	for (int lightID : unboundedLights)
+		addLight(lightID, isWeighted ? PMF(p, lightID) : 1.f);
+
+	if (nodes.empty())
+		return sum;
+
+	// a light has a density only if dir reaches it, so the nodes dir misses are skipped
+	const float invDir[3] = { 1.f / dir.x, 1.f / dir.y, 1.f / dir.z };
+	const bool isBVHWeighted = isWeighted && mode == Mode::BVH;
+
+	int nodeIdxStack[LIGHT_BVH_STACK_SIZE];
+	float pmfStack[LIGHT_BVH_STACK_SIZE];
+	int stackSize = 0;
+	nodeIdxStack[stackSize] = 0;
+	pmfStack[stackSize] = isBVHWeighted && nodes[0].bounds.Importance(p) == 0 ? 0.f : BoundedP();
+	stackSize++;
+
+	while (stackSize > 0) {
+		stackSize--;
+		const int nodeIdx = nodeIdxStack[stackSize];
+		const float pmf = pmfStack[stackSize];
+		const auto & node = nodes[nodeIdx];
+		if ((isBVHWeighted && pmf == 0) || !IsHit(node.bounds.box, p, invDir))
+			continue;
+
+		if (node.lightID != -1) {
+			const float weight = !isWeighted ? 1.f : (isBVHWeighted ? pmf : PMF(p, node.lightID));
+			addLight(node.lightID, weight);
+			continue;
+		}
+
+		float p0 = 1.f;
+		float p1 = 1.f;
+		if (isBVHWeighted && !ChildrenP(p, nodeIdx, p0, p1))
+			continue;
+
+		nodeIdxStack[stackSize] = node.secondChild;
+		pmfStack[stackSize] = pmf * p1;
+		stackSize++;
+		nodeIdxStack[stackSize] = nodeIdx + 1;
+		pmfStack[stackSize] = pmf * p0;
+		stackSize++;
+	}
+
+	return sum;
+}
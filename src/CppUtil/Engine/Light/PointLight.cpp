@@ -28,3 +28,12 @@ const RGBf PointLight::Sample_L(const Point3 & p, Normalf & wi, float & distToLi
 	PD = 1.0f;
 	return intensity * color / dist2 * falloff;
 }
+
+bool PointLight::GetBounds(BBoxf & box, Normalf & axis, float & cosTheta_o, float & cosTheta_e, float & power) const {
+	box = BBoxf(Point3(0.f), Point3(0.f));
+	axis = Normalf(0, 1, 0);
+	cosTheta_o = -1.f;
+	cosTheta_e = 0.f;
+	power = 4 * Math::PI * IlluminancePower().Illumination();
+	return true;
+}
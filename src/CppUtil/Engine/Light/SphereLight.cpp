@@ -8,50 +8,50 @@ using namespace CppUtil::Basic;
 using namespace std;
 
 const RGBf SphereLight::Sample_L(const Point3 & p, Normalf & wi, float & distToLight, float & PD) const {
-	if (Vec3f(p).Norm() < radius) {
+	const float dist2 = Vec3f(p).Norm2();
+	const float radius2 = radius * radius;
+	if (dist2 <= radius2) {
 		PD = 0;
 		return RGBf(0);
 	}
 
-	// ʱȼ򵥵ؾȲ
-	auto normal = BasicSampler::UniformOnSphere();
-	auto pos = radius * normal;
-	auto d = pos - p;
-	
-	auto dist2 = d.Dot(d);
+	// uniform in the cone of the sphere seen from p, so every sample is on the side facing p
+	const float sin2ThetaMax = radius2 / dist2;
+	const auto dirInCone = BasicSampler::UniformInCone(sin2ThetaMax);
 
-	distToLight = sqrt(dist2);
+	const float dist = sqrt(dist2);
+	const Normalf dirToCenter = Vec3f(p) / (-dist);
+	wi = (dirToCenter.GenCoordSpace() * Normalf(dirInCone)).Normalize();
 
-	wi = d / distToLight;
+	// the nearer intersection of the ray and the sphere
+	const float sin2Theta = dirInCone.x * dirInCone.x + dirInCone.y * dirInCone.y;
+	distToLight = dist * dirInCone.z - sqrt(max(0.f, radius2 - dist2 * sin2Theta));
 
-	float cosTheta = (-wi).Dot(normal);
-	float area = 4.f * Math::PI * radius * radius;
-	PD = dist2 / (area * Math::Abs(cosTheta));
-
-	return cosTheta < 0 ? RGBf(0) : Luminance();
+	PD = BasicSampler::PDofUniformInCone(sin2ThetaMax);
+	return Luminance();
 }
 
 float SphereLight::PDF(const Point3 & p, const Normalf & wi) const {
-	// (p + t * wi)^2 = r^2
-	// wi^2 * t^2 + 2*(p.wi) * t + p^2-r^2 = 0
-
-	float a = wi.Norm2();
-	float b = Vec3f(p).Dot(wi);
-	float c = Vec3f(p).Norm2() - radius * radius;
-	
-	float discriminant = b * b - a * c;
-
-	if (discriminant <= 0)
+	const float dist2 = Vec3f(p).Norm2();
+	const float radius2 = radius * radius;
+	if (dist2 <= radius2)
 		return 0;
 
-	float t = -(b + discriminant) / a;
-	if (t < 0)
+	// (p + t * wi)^2 = r^2 has a root t > 0
+	// wi^2 * t^2 + 2*(p.wi) * t + p^2-r^2 = 0
+	const float b = Vec3f(p).Dot(wi);
+	const float discriminant = b * b - (dist2 - radius2);
+	if (b >= 0 || discriminant < 0)
 		return 0;
 
-	auto pos = p + t * Vec3(wi);
-	auto dist2 = (p - pos).Norm2();
-	auto normal = Vec3f(pos).Normalize();
-	float area = 4.f * Math::PI * radius * radius;
-	float cosTheta = normal.Dot(-wi); // positive
-	return dist2 / (area * cosTheta);
+	return BasicSampler::PDofUniformInCone(radius2 / dist2);
+}
+
+bool SphereLight::GetBounds(BBoxf & box, Normalf & axis, float & cosTheta_o, float & cosTheta_e, float & power) const {
+	box = BBoxf(Point3(-radius), Point3(radius));
+	axis = Normalf(0, 1, 0);
+	cosTheta_o = -1.f;
+	cosTheta_e = 0.f;
+	power = LuminancePower().Illumination();
+	return true;
 }
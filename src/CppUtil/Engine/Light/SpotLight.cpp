@@ -42,3 +42,15 @@ float SpotLight::Falloff(const Normalf & wi) const {
 
 	return (delta * delta) * (delta * delta);
 }
+
+bool SpotLight::GetBounds(BBoxf & box, Normalf & axis, float & cosTheta_o, float & cosTheta_e, float & power) const {
+	// lights to -y, fully within the falloff angle and fading out to the half angle
+	const float cosHalfAngle = CosHalfAngle();
+	const float cosFalloffAngle = CosFalloffAngle();
+	box = BBoxf(Point3(0.f), Point3(0.f));
+	axis = Normalf(0, -1, 0);
+	cosTheta_o = cosFalloffAngle;
+	cosTheta_e = cos(acos(cosHalfAngle) - acos(cosFalloffAngle));
+	power = 2 * Math::PI * (1 - 0.5f * (cosHalfAngle + cosFalloffAngle)) * IlluminancePower().Illumination();
+	return true;
+}
@@ -1,6 +1,10 @@
+#ifdef WIN32
+#define _CRT_SECURE_NO_WARNINGS 1
+#endif // WIN32
+
 #include <CppUtil/Engine/BVHAccel.h>
 
-#include "BVHNode.h"
+#include "BVHBuilder.h"
 
 #include <CppUtil/Engine/Sphere.h>
 #include <CppUtil/Engine/Plane.h>
@@ -15,11 +19,73 @@
 #include <CppUtil/Basic/Visitor.h>
 #include <CppUtil/Basic/Timer.h>
 
+#include <algorithm>
+#include <cstdio>
+
 using namespace CppUtil;
 using namespace CppUtil::Engine;
 using namespace CppUtil::Basic;
 using namespace std;
 
+namespace {
+	// FNV-1a, the hash names the cache files, so it must not depend on the platform
+	constexpr uint64_t fnvOffset = 14695981039346656037ull;
+	constexpr uint64_t fnvPrime = 1099511628211ull;
+
+	uint64_t HashBytes(const void * data, size_t size, uint64_t hash = fnvOffset) {
+		const auto bytes = static_cast<const uint8_t *>(data);
+		for (size_t i = 0; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= fnvPrime;
+		}
+		return hash;
+	}
+
+	template<typename T>
+	uint64_t HashVal(const T & val, uint64_t hash) {
+		return HashBytes(&val, sizeof(T), hash);
+	}
+
+	// header of the cache file
+	struct BVHFileHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t hash;
+		uint32_t nodeSize; // layout check of LinearBVHNode
+		uint32_t nodeNum;
+		uint32_t refNum; // size of primIndices, larger than the primitive num after spatial splits
+		uint32_t reserved; // keep the size a multiple of 8 without uninitialized padding
+	};
+
+	constexpr uint32_t bvhFileMagic = 0x48564252; // "RBVH"
+	constexpr uint32_t bvhFileVersion = 1;
+
+	const char * BuildModeName(BVHAccel::BuildMode mode) {
+		switch (mode)
+		{
+		case BVHAccel::BuildMode::SBVH:
+			return "SBVH";
+		case BVHAccel::BuildMode::LBVH:
+			return "LBVH";
+		case BVHAccel::BuildMode::HLBVH:
+			return "HLBVH";
+		default:
+			return "SAH";
+		}
+	}
+
+	void InitLinearBVHNodes(const vector<BVHBuilder::Node> & nodes, vector<BVHAccel::LinearBVHNode> & linearBVHNodes) {
+		linearBVHNodes.resize(nodes.size());
+		for (size_t i = 0; i < nodes.size(); i++) {
+			const auto & node = nodes[i];
+			if (node.num != 0)
+				linearBVHNodes[i].InitLeaf(node.box, node.offset, node.num);
+			else
+				linearBVHNodes[i].InitBranch(node.box, node.offset, node.axis);
+		}
+	}
+}
+
 // ------------ BVHInitVisitor ------------
 
 class BVHAccel::BVHInitVisitor : public Visitor {
@@ -35,7 +101,8 @@ public:
 	}
 
 public:
-	unordered_map<Ptr<Shape>, BBoxf> shape2wbbox;
+	// world box of instances[i]
+	vector<BBoxf> instanceBoxes;
 
 public:
 	static const Ptr<BVHInitVisitor> New(BVHAccel * holder) {
@@ -51,96 +118,552 @@ public:
 		if (!primitive)
 			return;
 
-		const auto w2l = geo->GetSObj()->GetLocalToWorldMatrix().Inverse();
-		holder->worldToLocalMatrixes[primitive] = w2l;
-
-		holder->primitive2sobj[geo->primitive] = geo->GetSObj();
-		geo->primitive->Accept(This());
+		l2w = geo->GetSObj()->GetLocalToWorldMatrix();
+		sobj = geo->GetSObj();
+		geometry = geo;
+		primitive->Accept(This());
 	}
 
 	void Visit(Ptr<Sphere> sphere) {
-		const auto l2w = holder->GetShapeW2LMat(sphere).Inverse();
-		holder->shapes.push_back(sphere);
-		shape2wbbox[sphere] = l2w(sphere->GetBBox());
+		AddInstance(PrimType::Sphere, sphere->GetBBox());
 	}
 
 	void Visit(Ptr<Plane> plane) {
-		const auto l2w = holder->GetShapeW2LMat(plane).Inverse();
-		holder->shapes.push_back(plane);
-		shape2wbbox[plane] = l2w(plane->GetBBox());
+		AddInstance(PrimType::Plane, plane->GetBBox());
 	}
 
 	void Visit(Ptr<TriMesh> mesh) {
-		const auto l2w = holder->GetShapeW2LMat(mesh).Inverse();
-		for (auto triangle : mesh->GetTriangles()) {
-			holder->shapes.push_back(triangle);
-			shape2wbbox[triangle] = l2w(triangle->GetBBox());
-		}
+		auto meshBVH = holder->GetMeshBVH(mesh);
+		if (meshBVH->tree.IsEmpty())
+			return;
+
+		AddInstance(PrimType::TriMesh, meshBVH->tree.GetBox());
+		holder->instances.back().mesh = mesh;
+		holder->instances.back().meshBVH = meshBVH;
 	}
 
 	void Visit(Ptr<Disk> disk) {
-		const auto l2w = holder->GetShapeW2LMat(disk).Inverse();
-		holder->shapes.push_back(disk);
-		shape2wbbox[disk] = l2w(disk->GetBBox());
+		AddInstance(PrimType::Disk, disk->GetBBox());
 	}
 
 	void Visit(Ptr<Capsule> capsule) {
-		const auto l2w = holder->GetShapeW2LMat(capsule).Inverse();
-		holder->shapes.push_back(capsule);
-		shape2wbbox[capsule] = l2w(capsule->GetBBox());
+		AddInstance(PrimType::Capsule, capsule->GetBBox(), capsule->height / 2);
+	}
+
+private:
+	void AddInstance(PrimType type, const BBoxf & localBox, float halfHeight = 0.f) {
+		holder->instances.push_back({ l2w.Inverse(), l2w, sobj, type, halfHeight, nullptr, nullptr,
+			localBox, geometry->primitive->GetBBox(), geometry, geometry->primitive.get() });
+		instanceBoxes.push_back(l2w(localBox));
 	}
 
 private:
 	BVHAccel * holder;
+
+	// current CmptGeometry
+	Transform l2w;
+	Ptr<SObj> sobj;
+	Ptr<CmptGeometry> geometry;
 };
 
-const Transform & BVHAccel::GetShapeW2LMat(Ptr<Shape> shape) const {
-	const auto target = worldToLocalMatrixes.find(shape->GetPrimitive());
-	assert(target != worldToLocalMatrixes.cend());
+// ------------ Tree ------------
+
+void BVHAccel::Tree::Clear() {
+	linearBVHNodes.clear();
+	wideNodes.clear();
+	compressedNodes.clear();
+}
+
+void BVHAccel::Tree::Build(const vector<BBoxf> & boxes, vector<int> & primIndices) {
+	Clear();
+
+	BVHBuilder builder;
+	builder.Build(boxes);
+	primIndices = builder.GetPrimIndices();
+	InitLinearBVHNodes(builder.GetNodes(), linearBVHNodes);
+
+	Collapse();
+}
+
+void BVHAccel::Tree::BuildSpatial(const vector<BBoxf> & boxes, const ClipFunc & clip, vector<int> & primIndices, float splitBudget) {
+	Clear();
+
+	BVHBuilder builder;
+	builder.BuildSpatial(boxes, clip, splitBudget);
+	primIndices = builder.GetPrimIndices();
+	InitLinearBVHNodes(builder.GetNodes(), linearBVHNodes);
+
+	Collapse();
+}
+
+void BVHAccel::Tree::Refit(const vector<BBoxf> & boxes) {
+	// children are after their parent in depth first order
+	for (int i = static_cast<int>(linearBVHNodes.size()) - 1; i >= 0; i--) {
+		auto & node = linearBVHNodes[i];
+		BBoxf box;
+		if (node.IsLeaf()) {
+			const int shapesEnd = node.GetShapesOffset() + node.GetShapesNum();
+			for (int k = node.GetShapesOffset(); k < shapesEnd; k++)
+				box.UnionWith(boxes[k]);
+		}
+		else {
+			box = linearBVHNodes[LinearBVHNode::FirstChildIdx(i)].GetBox();
+			box.UnionWith(linearBVHNodes[node.GetSecondChildIdx()].GetBox());
+		}
+		node.SetBox(box);
+	}
+
+	Collapse();
+}
+
+bool BVHAccel::Tree::Save(const string & path, uint64_t hash, const vector<int> & primIndices) const {
+	FILE * file = fopen(path.c_str(), "wb");
+	if (!file) {
+		printf("WARNING::BVHAccel::Tree::Save:\n"
+			"\t""can't open %s\n", path.c_str());
+		return false;
+	}
+
+	const BVHFileHeader header = {
+		bvhFileMagic, bvhFileVersion, hash,
+		static_cast<uint32_t>(sizeof(LinearBVHNode)),
+		static_cast<uint32_t>(linearBVHNodes.size()),
+		static_cast<uint32_t>(primIndices.size()),
+		0,
+	};
+	bool isSuccess = fwrite(&header, sizeof(header), 1, file) == 1;
+	if (isSuccess && !linearBVHNodes.empty())
+		isSuccess = fwrite(linearBVHNodes.data(), sizeof(LinearBVHNode), linearBVHNodes.size(), file) == linearBVHNodes.size();
+	if (isSuccess && !primIndices.empty())
+		isSuccess = fwrite(primIndices.data(), sizeof(int), primIndices.size(), file) == primIndices.size();
+	fclose(file);
+
+	if (!isSuccess) {
+		printf("WARNING::BVHAccel::Tree::Save:\n"
+			"\t""write %s fail\n", path.c_str());
+		remove(path.c_str());
+	}
+	return isSuccess;
+}
+
+bool BVHAccel::Tree::Load(const string & path, uint64_t hash, int primNum, vector<int> & primIndices) {
+	Clear();
+
+	FILE * file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+
+	BVHFileHeader header;
+	bool isValid = fread(&header, sizeof(header), 1, file) == 1
+		&& header.magic == bvhFileMagic
+		&& header.version == bvhFileVersion
+		&& header.hash == hash
+		&& header.nodeSize == sizeof(LinearBVHNode)
+		&& header.refNum >= static_cast<uint32_t>(primNum)
+		&& (header.nodeNum > 0) == (primNum > 0);
+
+	if (isValid) {
+		linearBVHNodes.resize(header.nodeNum);
+		primIndices.resize(header.refNum);
+		isValid = fread(linearBVHNodes.data(), sizeof(LinearBVHNode), header.nodeNum, file) == header.nodeNum
+			&& fread(primIndices.data(), sizeof(int), header.refNum, file) == header.refNum;
+	}
+	fclose(file);
+
+	// a corrupted file must not lead to out of range access in traversal
+	const int nodeNum = static_cast<int>(linearBVHNodes.size());
+	const int refNum = static_cast<int>(primIndices.size());
+	for (int i = 0; isValid && i < nodeNum; i++) {
+		const auto & node = linearBVHNodes[i];
+		if (node.IsLeaf())
+			isValid = node.GetShapesOffset() >= 0 && node.GetShapesOffset() + node.GetShapesNum() <= refNum;
+		else
+			isValid = node.GetSecondChildIdx() > i + 1 && node.GetSecondChildIdx() < nodeNum;
+	}
+	for (int i = 0; isValid && i < refNum; i++)
+		isValid = primIndices[i] >= 0 && primIndices[i] < primNum;
+
+	if (!isValid) {
+		printf("WARNING::BVHAccel::Tree::Load:\n"
+			"\t""%s is out of date or corrupted, rebuild\n", path.c_str());
+		Clear();
+		primIndices.clear();
+		return false;
+	}
+
+	Collapse();
+
+	return true;
+}
+
+void BVHAccel::Tree::BuildLinear(const vector<BBoxf> & boxes, vector<int> & primIndices, bool isHLBVH) {
+	Clear();
+
+	BVHBuilder builder;
+	builder.BuildLinear(boxes, isHLBVH);
+	primIndices = builder.GetPrimIndices();
+	InitLinearBVHNodes(builder.GetNodes(), linearBVHNodes);
+
+	Collapse();
+}
+
+void BVHAccel::Tree::AlignLeaves(int groupSize, vector<int> & primIndices) {
+	vector<int> alignedIndices;
+	alignedIndices.reserve(primIndices.size() + primIndices.size() / 2);
+	for (auto & node : linearBVHNodes) {
+		if (!node.IsLeaf())
+			continue;
+
+		const int offset = node.GetShapesOffset();
+		const int num = node.GetShapesNum();
+		const int alignedOffset = static_cast<int>(alignedIndices.size());
+		alignedIndices.insert(alignedIndices.end(), primIndices.begin() + offset, primIndices.begin() + offset + num);
+		while (alignedIndices.size() % groupSize != 0)
+			alignedIndices.push_back(primIndices[offset]);
+
+		node.InitLeaf(node.GetBox(), alignedOffset, num);
+	}
+	primIndices.swap(alignedIndices);
+
+	Collapse();
+}
+
+float BVHAccel::Tree::GetSAHCost() const {
+	if (linearBVHNodes.empty())
+		return 0.f;
+
+	const float rootArea = linearBVHNodes[0].GetBox().SurfaceArea();
+	if (rootArea <= 0.f)
+		return 0.f;
 
-	return target->second;
+	float cost = 0.f;
+	for (const auto & node : linearBVHNodes) {
+		const float ratio = node.GetBox().SurfaceArea() / rootArea;
+		cost += ratio * (node.IsLeaf() ? node.GetShapesNum() : BVHBuilder::t_trav);
+	}
+	return cost;
 }
 
-const Ptr<SObj> BVHAccel::GetSObj(Ptr<Shape> shape) const{
-	const auto target = primitive2sobj.find(shape->GetPrimitive());
-	assert(target != primitive2sobj.cend());
+template<typename NodeT>
+int BVHAccel::Tree::CollapseBVH(int nodeIdx, vector<NodeT> & nodes) {
+	const int wideIdx = static_cast<int>(nodes.size());
+	nodes.push_back(NodeT());
+	nodes[wideIdx].Init(linearBVHNodes[nodeIdx].GetBox());
+
+	// open the interior child with the largest surface area until the node is full
+	int children[BVH_WIDTH];
+	int childNum;
+	const auto & node = linearBVHNodes[nodeIdx];
+	if (node.IsLeaf()) {
+		children[0] = nodeIdx;
+		childNum = 1;
+	}
+	else {
+		children[0] = LinearBVHNode::FirstChildIdx(nodeIdx);
+		children[1] = node.GetSecondChildIdx();
+		childNum = 2;
+		while (childNum < BVH_WIDTH) {
+			int best = -1;
+			float bestArea = -1.f;
+			for (int i = 0; i < childNum; i++) {
+				const auto & child = linearBVHNodes[children[i]];
+				if (child.IsLeaf())
+					continue;
+
+				const float area = child.GetBox().SurfaceArea();
+				if (area > bestArea) {
+					best = i;
+					bestArea = area;
+				}
+			}
+			if (best == -1)
+				break;
+
+			// keep the depth first order of the children
+			const int openIdx = children[best];
+			for (int i = childNum; i > best + 1; i--)
+				children[i] = children[i - 1];
+			children[best] = LinearBVHNode::FirstChildIdx(openIdx);
+			children[best + 1] = linearBVHNodes[openIdx].GetSecondChildIdx();
+			childNum++;
+		}
+	}
 
-	return target->second;
+	for (int i = 0; i < childNum; i++) {
+		const auto & child = linearBVHNodes[children[i]];
+		if (child.IsLeaf())
+			nodes[wideIdx].SetLeaf(i, child.GetBox(), child.GetShapesOffset(), child.GetShapesNum());
+		else {
+			const int childWideIdx = CollapseBVH(children[i], nodes);
+			nodes[wideIdx].SetInterior(i, child.GetBox(), childWideIdx);
+		}
+	}
+
+	return wideIdx;
 }
 
+void BVHAccel::Tree::Collapse() {
+	wideNodes.clear();
+	compressedNodes.clear();
+	if (linearBVHNodes.empty())
+		return;
+
+	if (isCompressed)
+		CollapseBVH(0, compressedNodes);
+	else
+		CollapseBVH(0, wideNodes);
+}
+
+// ------------ BVHAccel ------------
+
 void BVHAccel::Clear() {
-	worldToLocalMatrixes.clear();
-	primitive2sobj.clear();
-	shapes.clear();
-	linearBVHNodes.clear();
+	instances.clear();
+	tlas.Clear();
+}
+
+const Ptr<const BVHAccel::MeshBVH> BVHAccel::GetMeshBVH(Ptr<TriMesh> mesh) {
+	auto target = meshBVHs.find(mesh.get());
+	if (target != meshBVHs.end() && target->second->mesh.lock() == mesh
+		&& target->second->buildMode == buildMode && target->second->isCompressed == isCompressed)
+		return target->second;
+
+	// triangles in the local space of the mesh
+	const auto & positions = mesh->GetPositions();
+	const auto & triangles = mesh->GetTriangles();
+	vector<BBoxf> boxes;
+	boxes.reserve(triangles.size());
+	for (const auto & triangle : triangles) {
+		BBoxf box;
+		for (int i = 0; i < 3; i++)
+			box.UnionWith(positions[triangle->idx[i]]);
+		boxes.push_back(box);
+	}
+
+	auto meshBVH = make_shared<MeshBVH>();
+	meshBVH->mesh = mesh;
+	meshBVH->buildMode = buildMode;
+	meshBVH->isCompressed = isCompressed;
+	meshBVH->hash = HashBytes(positions.data(), positions.size() * sizeof(Point3));
+	for (const auto & triangle : triangles)
+		meshBVH->hash = HashVal(triangle->idx, meshBVH->hash);
+
+	// clip the triangle polygon, tighter than splitting its box
+	Tree::ClipFunc clip = [&](int triIdx, const BBoxf & box, int axis, float pos, BBoxf & left, BBoxf & right) {
+		left = BBoxf();
+		right = BBoxf();
+		const auto & triangle = triangles[triIdx];
+		for (int i = 0; i < 3; i++) {
+			const auto & v0 = positions[triangle->idx[i]];
+			const auto & v1 = positions[triangle->idx[(i + 1) % 3]];
+			if (v0[axis] <= pos)
+				left.UnionWith(v0);
+			if (v0[axis] >= pos)
+				right.UnionWith(v0);
+			if ((v0[axis] < pos && v1[axis] > pos) || (v0[axis] > pos && v1[axis] < pos)) {
+				const float t = (pos - v0[axis]) / (v1[axis] - v0[axis]);
+				auto p = Point3::Lerp(v0, v1, t);
+				p[axis] = pos;
+				left.UnionWith(p);
+				right.UnionWith(p);
+			}
+		}
+		left = BBoxf::Intersect(left, box);
+		right = BBoxf::Intersect(right, box);
+	};
+
+	vector<int> triIndices;
+	BuildTree(meshBVH->tree, boxes, triIndices, "mesh", meshBVH->hash, clip);
+	meshBVH->tree.AlignLeaves(TriangleGroup::size, triIndices);
+
+	meshBVH->indice.reserve(3 * triIndices.size());
+	for (int triIdx : triIndices) {
+		for (int i = 0; i < 3; i++)
+			meshBVH->indice.push_back(static_cast<int>(triangles[triIdx]->idx[i]));
+	}
+
+	meshBVH->triGroups.resize(triIndices.size() / TriangleGroup::size);
+	for (size_t i = 0; i < triIndices.size(); i++) {
+		auto & group = meshBVH->triGroups[i / TriangleGroup::size];
+		const int lane = static_cast<int>(i % TriangleGroup::size);
+		const int * idx = &meshBVH->indice[3 * i];
+		const auto & p1 = positions[idx[0]];
+		const auto e1 = positions[idx[1]] - p1;
+		const auto e2 = positions[idx[2]] - p1;
+		for (int axis = 0; axis < 3; axis++) {
+			group.p1[axis][lane] = p1[axis];
+			group.e1[axis][lane] = e1[axis];
+			group.e2[axis][lane] = e2[axis];
+		}
+	}
+
+	meshBVHs[mesh.get()] = meshBVH;
+	builtMeshBVHNum++;
+	return meshBVH;
 }
 
 void BVHAccel::Init(Ptr<SObj> root) {
 	Clear();
 
+	printf("Building BVH...\n");
+	Timer timer;
+	timer.Start();
+
+	// drop the bottom levels of deleted meshes
+	for (auto iter = meshBVHs.begin(); iter != meshBVHs.end();) {
+		if (iter->second->mesh.expired())
+			iter = meshBVHs.erase(iter);
+		else
+			++iter;
+	}
+	builtMeshBVHNum = 0;
+	loadedTreeNum = 0;
+
 	auto geos = root->GetComponentsInChildren<CmptGeometry>();
+	geometryNum = count_if(geos.begin(), geos.end(), [](const Ptr<CmptGeometry> & geo) { return geo->primitive != nullptr; });
 	auto initVisitor = BVHInitVisitor::New(this);
 	for (auto geo : geos)
 		geo->Accept(initVisitor);
 
-	printf("Building BVH...\n");
+	// reorder instances so that leaves refer to continuous ranges
+	// the top level is cheap to build and changes with every move, so it is not cached
+	vector<int> instanceIndices;
+	BuildTree(tlas, initVisitor->instanceBoxes, instanceIndices, "", 0);
+	vector<Instance> orderedInstances;
+	orderedInstances.reserve(instanceIndices.size());
+	for (int instanceIdx : instanceIndices)
+		orderedInstances.push_back(instances[instanceIdx]);
+	instances.swap(orderedInstances);
+
+	builtSAHCost = GetSAHCost();
+
+	timer.Stop();
+	buildTime = timer.GetWholeTime();
+	printf("BVH build done (%s), cost %f s, %zd instances, %zd meshes (%d built), %d trees loaded from cache, %d %d-wide top level nodes, SAH cost %f\n",
+		BuildModeName(buildMode), buildTime, instances.size(), meshBVHs.size(), builtMeshBVHNum, loadedTreeNum, tlas.GetWideNodeNum(), BVH_WIDTH, GetSAHCost());
+}
+
+void BVHAccel::BuildTree(Tree & tree, const vector<BBoxf> & boxes, vector<int> & primIndices,
+	const string & name, uint64_t hash, const Tree::ClipFunc & clip)
+{
+	tree.SetCompressed(isCompressed);
+	auto build = [&]() {
+		switch (buildMode)
+		{
+		case BuildMode::SBVH:
+			if (clip)
+				tree.BuildSpatial(boxes, clip, primIndices);
+			else
+				tree.Build(boxes, primIndices);
+			break;
+		case BuildMode::LBVH:
+			tree.BuildLinear(boxes, primIndices, false);
+			break;
+		case BuildMode::HLBVH:
+			tree.BuildLinear(boxes, primIndices, true);
+			break;
+		default:
+			tree.Build(boxes, primIndices);
+			break;
+		}
+	};
+
+	if (cacheDir.empty() || name.empty()) {
+		build();
+		return;
+	}
+
+	// trees of different build modes are different files
+	if (buildMode != BuildMode::SAH)
+		hash = HashVal(buildMode, hash);
+
+	char fileName[64];
+	sprintf(fileName, "%s_%016llx.bvh", name.c_str(), static_cast<unsigned long long>(hash));
+	const string path = cacheDir + fileName;
+	if (tree.Load(path, hash, static_cast<int>(boxes.size()), primIndices)) {
+		loadedTreeNum++;
+		return;
+	}
+
+	build();
+	tree.Save(path, hash, primIndices);
+}
+
+void BVHAccel::SetBuildMode(BuildMode mode) {
+	if (mode == buildMode)
+		return;
+
+	buildMode = mode;
+	// makes Update fall back to Init
+	tlas.Clear();
+}
+
+void BVHAccel::SetCompressed(bool isCompressed) {
+	if (isCompressed == this->isCompressed)
+		return;
+
+	this->isCompressed = isCompressed;
+	// makes Update fall back to Init
+	tlas.Clear();
+}
+
+void BVHAccel::Update(Ptr<SObj> root) {
+	auto geos = root->GetComponentsInChildren<CmptGeometry>();
+	bool isChanged = false;
+	if (tlas.IsEmpty() || !UpdateTransforms(geos, isChanged)) {
+		Init(root);
+		return;
+	}
+
+	if (!isChanged)
+		return;
+
 	Timer timer;
 	timer.Start();
-	const auto bvhRoot = BVHNode::New(initVisitor->shape2wbbox, shapes, 0, shapes.size());
-	LinearizeBVH(bvhRoot);
+
+	vector<BBoxf> boxes;
+	boxes.reserve(instances.size());
+	for (const auto & instance : instances)
+		boxes.push_back(instance.localToWorld(instance.localBox));
+	tlas.Refit(boxes);
+
+	const float cost = GetSAHCost();
+	if (cost > maxRefitCostRatio * builtSAHCost) {
+		printf("BVH refit SAH cost %f is much larger than %f, rebuild\n", cost, builtSAHCost);
+		Init(root);
+		return;
+	}
+
 	timer.Stop();
-	printf("BVH build done, cost %f s\n", timer.GetWholeTime());
+	buildTime = timer.GetWholeTime();
+	printf("BVH refit done, cost %f s, %zd instances, SAH cost %f\n", buildTime, instances.size(), cost);
 }
 
-void BVHAccel::LinearizeBVH(Ptr<BVHNode> bvhNode) {
-	linearBVHNodes.push_back(LinearBVHNode());
-	const auto curNodeIdx = linearBVHNodes.size() - 1;
+bool BVHAccel::UpdateTransforms(const vector<Ptr<CmptGeometry>> & geos, bool & isChanged) {
+	isChanged = false;
+	// a geometry given a primitive has no instance yet
+	const auto primitiveNum = count_if(geos.begin(), geos.end(), [](const Ptr<CmptGeometry> & geo) { return geo->primitive != nullptr; });
+	if (static_cast<size_t>(primitiveNum) != geometryNum)
+		return false;
+
+	for (auto & instance : instances) {
+		auto geometry = instance.geometry.lock();
+		if (geometry == nullptr || geometry->primitive.get() != instance.primitive || geometry->GetSObj() != instance.sobj)
+			return false;
 
-	if (!bvhNode->IsLeaf()) {
-		LinearizeBVH(bvhNode->GetL());
-		linearBVHNodes[curNodeIdx].InitBranch(bvhNode->GetBBox(), static_cast<int>(linearBVHNodes.size()), bvhNode->GetAxis());
-		LinearizeBVH(bvhNode->GetR());
+		// primitives edited in place, such as the height of a capsule
+		if (instance.primitiveBox != instance.primitive->GetBBox())
+			return false;
+		if (instance.type == PrimType::Capsule && static_cast<const Capsule *>(instance.primitive)->height / 2 != instance.halfHeight)
+			return false;
+
+		const auto l2w = instance.sobj->GetLocalToWorldMatrix();
+		if (l2w == instance.localToWorld)
+			continue;
+
+		instance.localToWorld = l2w;
+		instance.worldToLocal = l2w.Inverse();
+		isChanged = true;
 	}
-	else
-		linearBVHNodes[curNodeIdx].InitLeaf(bvhNode->GetBBox(), static_cast<int>(bvhNode->GetShapeOffset()), static_cast<int>(bvhNode->GetShapesNum()));
+
+	return true;
 }
@@ -0,0 +1,727 @@
+#include "BVHBuilder.h"
+
+#include <algorithm>
+#include <numeric>
+#include <future>
+#include <thread>
+#include <cfloat>
+
+using namespace CppUtil;
+using namespace CppUtil::Engine;
+using namespace CppUtil::Basic;
+using namespace std;
+
+namespace {
+	// subtrees smaller than this are built in the current task
+	constexpr int minParallelNum = 8192;
+
+	// spatial splits are only tried if the object split children overlap more than this, relative to the root
+	constexpr float spatialSplitAlpha = 1e-5f;
+
+	// HLBVH treelets share the top bits of their codes
+	// the top level has at most 2^12 leaves, with median splits from depth 12 on its depth is below 24
+	constexpr int treeletBitNum = 12;
+	constexpr int treeletTopMedianDepth = 12;
+	constexpr int treeletDepth = treeletTopMedianDepth + treeletBitNum;
+
+	// spread the bits of v so that there are two zero bits between any two of them, v < 2^21
+	uint64_t ExpandBits(uint64_t v) {
+		v &= 0x1fffff;
+		v = (v | v << 32) & 0x1f00000000ffffull;
+		v = (v | v << 16) & 0x1f0000ff0000ffull;
+		v = (v | v << 8) & 0x100f00f00f00f00full;
+		v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+		v = (v | v << 2) & 0x1249249249249249ull;
+		return v;
+	}
+
+	// run func(taskIdx) for taskIdx in [0, taskNum), the first one in the current thread
+	template<typename Func>
+	void ParallelTasks(int taskNum, const Func & func) {
+		vector<future<void>> tasks;
+		for (int i = 1; i < taskNum; i++)
+			tasks.push_back(async(launch::async, func, i));
+		func(0);
+		for (auto & task : tasks)
+			task.get();
+	}
+
+	// stable LSD radix sort of the low bitNum bits of T::code, 8 bits per pass
+	template<typename T>
+	void RadixSort(vector<T> & items, int bitNum, int taskNum) {
+		constexpr int digitBitNum = 8;
+		constexpr int digitNum = 1 << digitBitNum;
+
+		const int num = static_cast<int>(items.size());
+		const int chunkSize = (num + taskNum - 1) / taskNum;
+		vector<T> sorted(num);
+		vector<int> offsets(taskNum * digitNum);
+		for (int shift = 0; shift < bitNum; shift += digitBitNum) {
+			auto digitOf = [shift](const T & item) {
+				return static_cast<int>((item.code >> shift) & (digitNum - 1));
+			};
+
+			// 1. histogram of each chunk
+			ParallelTasks(taskNum, [&](int taskIdx) {
+				int * counts = &offsets[taskIdx * digitNum];
+				fill(counts, counts + digitNum, 0);
+				const int end = min(num, (taskIdx + 1) * chunkSize);
+				for (int i = taskIdx * chunkSize; i < end; i++)
+					counts[digitOf(items[i])]++;
+			});
+
+			// 2. digit major, chunk minor, keeps the sort stable
+			int sum = 0;
+			for (int digit = 0; digit < digitNum; digit++) {
+				for (int taskIdx = 0; taskIdx < taskNum; taskIdx++) {
+					const int count = offsets[taskIdx * digitNum + digit];
+					offsets[taskIdx * digitNum + digit] = sum;
+					sum += count;
+				}
+			}
+
+			// 3. scatter
+			ParallelTasks(taskNum, [&](int taskIdx) {
+				int * dst = &offsets[taskIdx * digitNum];
+				const int end = min(num, (taskIdx + 1) * chunkSize);
+				for (int i = taskIdx * chunkSize; i < end; i++)
+					sorted[dst[digitOf(items[i])]++] = items[i];
+			});
+
+			items.swap(sorted);
+		}
+	}
+
+	struct Bucket {
+		BBoxf box;
+		int num{ 0 };
+	};
+
+	struct SpatialBin {
+		BBoxf box;
+		int enterNum{ 0 };
+		int exitNum{ 0 };
+	};
+
+	int BucketIdx(float center, float left, float scale, int bucketNum) {
+		const int idx = static_cast<int>((center - left) * scale);
+		return Math::Clamp(idx, 0, bucketNum - 1);
+	}
+}
+
+BVHBuilder::BVHBuilder(int maxLeafSize, int bucketNum)
+	: maxLeafSize(maxLeafSize), bucketNum(Math::Clamp(bucketNum, 2, maxBucketNum)), medianSplitDepth(BVH_MAX_DEPTH - 32),
+	boxes(nullptr), clip(nullptr), minOverlapArea(0.f), remainingSplitNum(0)
+{
+	// a few more tasks than cores to balance uneven subtrees
+	int threadNum = static_cast<int>(thread::hardware_concurrency());
+	parallelDepth = 1;
+	while ((1 << parallelDepth) < 2 * threadNum)
+		parallelDepth++;
+}
+
+void BVHBuilder::Build(const vector<BBoxf> & boxes) {
+	this->boxes = &boxes;
+	nodes.clear();
+
+	const int primNum = static_cast<int>(boxes.size());
+	primIndices.resize(primNum);
+	iota(primIndices.begin(), primIndices.end(), 0);
+
+	centers.resize(primNum);
+	for (int i = 0; i < primNum; i++)
+		centers[i] = boxes[i].Center();
+
+	if (primNum > 0)
+		BuildRecursive(0, primNum, 0, nodes);
+
+	centers.clear();
+	centers.shrink_to_fit();
+	this->boxes = nullptr;
+}
+
+void BVHBuilder::BuildRecursive(int begin, int end, int depth, vector<Node> & nodes) {
+	const int curNodeIdx = static_cast<int>(nodes.size());
+	nodes.push_back(Node());
+
+	BBoxf box;
+	BBoxf centerBox;
+	for (int i = begin; i < end; i++) {
+		const int primIdx = primIndices[i];
+		box.UnionWith((*boxes)[primIdx]);
+		centerBox.UnionWith(centers[primIdx]);
+	}
+
+	const int num = end - begin;
+	if (num <= maxLeafSize) {
+		nodes[curNodeIdx] = { box, begin, num, -1 };
+		return;
+	}
+
+	int axis;
+	// median splits at most halve the range, so the remaining levels stay below 32
+	const int mid = depth < medianSplitDepth ?
+		Partition(begin, end, centerBox, axis) : MedianSplit(begin, end, centerBox, axis);
+
+	int secondChildIdx;
+	if (depth < parallelDepth && num >= minParallelNum) {
+		// subtrees are built into their own arrays and appended in depth first order
+		vector<Node> leftNodes;
+		vector<Node> rightNodes;
+		auto leftTask = async(launch::async, [&]() {
+			BuildRecursive(begin, mid, depth + 1, leftNodes);
+		});
+		BuildRecursive(mid, end, depth + 1, rightNodes);
+		leftTask.get();
+
+		auto append = [&nodes](const vector<Node> & subNodes) {
+			const int base = static_cast<int>(nodes.size());
+			for (auto node : subNodes) {
+				if (node.num == 0)
+					node.offset += base;
+				nodes.push_back(node);
+			}
+		};
+		append(leftNodes);
+		secondChildIdx = static_cast<int>(nodes.size());
+		append(rightNodes);
+	}
+	else {
+		BuildRecursive(begin, mid, depth + 1, nodes);
+		secondChildIdx = static_cast<int>(nodes.size());
+		BuildRecursive(mid, end, depth + 1, nodes);
+	}
+
+	nodes[curNodeIdx] = { box, secondChildIdx, 0, axis };
+}
+
+int BVHBuilder::Partition(int begin, int end, const BBoxf & centerBox, int & axis) {
+	// get best partition
+	float minCost = FLT_MAX;
+	int bestSplit = -1;
+	axis = -1;
+	for (int dim = 0; dim < 3; dim++) {
+		const float left = centerBox.minP[dim];
+		const float extent = centerBox.maxP[dim] - left;
+		if (extent <= 0)
+			continue;
+		const float scale = bucketNum / extent;
+
+		// 1. compute buckets
+		Bucket buckets[maxBucketNum];
+		for (int i = begin; i < end; i++) {
+			const int primIdx = primIndices[i];
+			auto & bucket = buckets[BucketIdx(centers[primIdx][dim], left, scale, bucketNum)];
+			bucket.num++;
+			bucket.box.UnionWith((*boxes)[primIdx]);
+		}
+
+		// 2. accumulate buckets from right
+		float rightArea[maxBucketNum];
+		int rightNum[maxBucketNum];
+		BBoxf accBox;
+		int accNum = 0;
+		for (int i = bucketNum - 1; i > 0; i--) {
+			accBox.UnionWith(buckets[i].box);
+			accNum += buckets[i].num;
+			rightArea[i] = accBox.SurfaceArea();
+			rightNum[i] = accNum;
+		}
+
+		// 3. sweep from left, split between bucket i - 1 and i
+		accBox = BBoxf();
+		accNum = 0;
+		for (int i = 1; i < bucketNum; i++) {
+			accBox.UnionWith(buckets[i - 1].box);
+			accNum += buckets[i - 1].num;
+			if (accNum == 0 || rightNum[i] == 0)
+				continue;
+
+			const float cost = t_trav + accBox.SurfaceArea() * accNum + rightArea[i] * rightNum[i];
+			if (cost < minCost) {
+				minCost = cost;
+				bestSplit = i;
+				axis = dim;
+			}
+		}
+	}
+
+	if (axis == -1) {
+		// all centers coincide, split in the middle to bound the leaf size
+		axis = centerBox.MaxExtent();
+		return (begin + end) / 2;
+	}
+
+	const float left = centerBox.minP[axis];
+	const float scale = bucketNum / (centerBox.maxP[axis] - left);
+	auto midIt = partition(primIndices.begin() + begin, primIndices.begin() + end, [=](int primIdx) {
+		return BucketIdx(centers[primIdx][axis], left, scale, bucketNum) < bestSplit;
+	});
+	return static_cast<int>(midIt - primIndices.begin());
+}
+
+int BVHBuilder::MedianSplit(int begin, int end, const BBoxf & centerBox, int & axis) {
+	axis = centerBox.MaxExtent();
+	const int mid = (begin + end) / 2;
+	const int dim = axis;
+	nth_element(primIndices.begin() + begin, primIndices.begin() + mid, primIndices.begin() + end, [this, dim](int lhs, int rhs) {
+		return centers[lhs][dim] < centers[rhs][dim];
+	});
+	return mid;
+}
+
+void BVHBuilder::BuildSpatial(const vector<BBoxf> & boxes, const ClipFunc & clip, float splitBudget) {
+	this->boxes = &boxes;
+	this->clip = &clip;
+	nodes.clear();
+	primIndices.clear();
+
+	const int primNum = static_cast<int>(boxes.size());
+	vector<Ref> refs(primNum);
+	BBoxf rootBox;
+	for (int i = 0; i < primNum; i++) {
+		refs[i] = { boxes[i], i };
+		rootBox.UnionWith(boxes[i]);
+	}
+	minOverlapArea = spatialSplitAlpha * rootBox.SurfaceArea();
+	remainingSplitNum = static_cast<int>(splitBudget * primNum);
+
+	if (primNum > 0)
+		BuildSpatialRecursive(refs, 0, nodes, primIndices);
+
+	this->clip = nullptr;
+	this->boxes = nullptr;
+}
+
+void BVHBuilder::BuildSpatialRecursive(vector<Ref> & refs, int depth, vector<Node> & nodes, vector<int> & indices) {
+	const int curNodeIdx = static_cast<int>(nodes.size());
+	nodes.push_back(Node());
+
+	BBoxf box;
+	BBoxf centerBox;
+	for (const auto & ref : refs) {
+		box.UnionWith(ref.box);
+		centerBox.UnionWith(ref.box.Center());
+	}
+
+	const int num = static_cast<int>(refs.size());
+	if (num <= maxLeafSize) {
+		nodes[curNodeIdx] = { box, static_cast<int>(indices.size()), num, -1 };
+		for (const auto & ref : refs)
+			indices.push_back(ref.primIdx);
+		return;
+	}
+
+	int axis;
+	vector<Ref> leftRefs;
+	vector<Ref> rightRefs;
+	SplitRefs(refs, depth, box, centerBox, leftRefs, rightRefs, axis);
+	// release the memory before going down
+	vector<Ref>().swap(refs);
+
+	int secondChildIdx;
+	if (depth < parallelDepth && num >= minParallelNum) {
+		// subtrees are built into their own arrays and appended in depth first order
+		vector<Node> leftNodes;
+		vector<Node> rightNodes;
+		vector<int> leftIndices;
+		vector<int> rightIndices;
+		auto leftTask = async(launch::async, [&]() {
+			BuildSpatialRecursive(leftRefs, depth + 1, leftNodes, leftIndices);
+		});
+		BuildSpatialRecursive(rightRefs, depth + 1, rightNodes, rightIndices);
+		leftTask.get();
+
+		auto append = [&nodes, &indices](const vector<Node> & subNodes, const vector<int> & subIndices) {
+			const int nodeBase = static_cast<int>(nodes.size());
+			const int indexBase = static_cast<int>(indices.size());
+			for (auto node : subNodes) {
+				node.offset += node.num == 0 ? nodeBase : indexBase;
+				nodes.push_back(node);
+			}
+			indices.insert(indices.end(), subIndices.begin(), subIndices.end());
+		};
+		append(leftNodes, leftIndices);
+		secondChildIdx = static_cast<int>(nodes.size());
+		append(rightNodes, rightIndices);
+	}
+	else {
+		BuildSpatialRecursive(leftRefs, depth + 1, nodes, indices);
+		secondChildIdx = static_cast<int>(nodes.size());
+		BuildSpatialRecursive(rightRefs, depth + 1, nodes, indices);
+	}
+
+	nodes[curNodeIdx] = { box, secondChildIdx, 0, axis };
+}
+
+void BVHBuilder::SplitRefs(vector<Ref> & refs, int depth, const BBoxf & box, const BBoxf & centerBox,
+	vector<Ref> & leftRefs, vector<Ref> & rightRefs, int & axis)
+{
+	// median splits at most halve the refs, so the remaining levels stay below 32
+	auto medianSplit = [&]() {
+		axis = centerBox.MaxExtent();
+		const int dim = axis;
+		const auto midIt = refs.begin() + refs.size() / 2;
+		nth_element(refs.begin(), midIt, refs.end(), [dim](const Ref & lhs, const Ref & rhs) {
+			return lhs.box.Center()[dim] < rhs.box.Center()[dim];
+		});
+		leftRefs.assign(refs.begin(), midIt);
+		rightRefs.assign(midIt, refs.end());
+	};
+
+	if (depth >= medianSplitDepth) {
+		medianSplit();
+		return;
+	}
+
+	int objectAxis;
+	int objectSplit;
+	float objectCost;
+	BBoxf leftBox;
+	BBoxf rightBox;
+	const bool hasObjectSplit = FindObjectSplit(refs, centerBox, objectAxis, objectSplit, objectCost, leftBox, rightBox);
+
+	// spatial splits only pay off if the children of the object split overlap
+	int spatialAxis;
+	float spatialPos;
+	float spatialCost;
+	bool hasSpatialSplit = false;
+	if (remainingSplitNum > 0) {
+		const auto overlap = BBoxf::Intersect(leftBox, rightBox);
+		if (!hasObjectSplit || (overlap.IsValid() && overlap.SurfaceArea() > minOverlapArea))
+			hasSpatialSplit = FindSpatialSplit(refs, box, spatialAxis, spatialPos, spatialCost);
+	}
+
+	if (hasSpatialSplit && (!hasObjectSplit || spatialCost < objectCost)) {
+		axis = spatialAxis;
+		for (const auto & ref : refs) {
+			if (ref.box.maxP[axis] <= spatialPos)
+				leftRefs.push_back(ref);
+			else if (ref.box.minP[axis] >= spatialPos)
+				rightRefs.push_back(ref);
+			else {
+				// straddling refs are split while the budget lasts
+				BBoxf left;
+				BBoxf right;
+				if (remainingSplitNum.fetch_sub(1) > 0)
+					(*clip)(ref.primIdx, ref.box, axis, spatialPos, left, right);
+
+				if (left.IsValid() && right.IsValid()) {
+					leftRefs.push_back({ left, ref.primIdx });
+					rightRefs.push_back({ right, ref.primIdx });
+				}
+				else if (left.IsValid() || (!right.IsValid() && ref.box.Center()[axis] < spatialPos))
+					leftRefs.push_back({ left.IsValid() ? left : ref.box, ref.primIdx });
+				else
+					rightRefs.push_back({ right.IsValid() ? right : ref.box, ref.primIdx });
+			}
+		}
+
+		if (!leftRefs.empty() && !rightRefs.empty())
+			return;
+
+		leftRefs.clear();
+		rightRefs.clear();
+	}
+
+	if (!hasObjectSplit) {
+		// all centers coincide
+		medianSplit();
+		return;
+	}
+
+	axis = objectAxis;
+	const float left = centerBox.minP[axis];
+	const float scale = bucketNum / (centerBox.maxP[axis] - left);
+	for (const auto & ref : refs) {
+		if (BucketIdx(ref.box.Center()[axis], left, scale, bucketNum) < objectSplit)
+			leftRefs.push_back(ref);
+		else
+			rightRefs.push_back(ref);
+	}
+}
+
+bool BVHBuilder::FindObjectSplit(const vector<Ref> & refs, const BBoxf & centerBox,
+	int & axis, int & split, float & cost, BBoxf & leftBox, BBoxf & rightBox) const
+{
+	cost = FLT_MAX;
+	axis = -1;
+	for (int dim = 0; dim < 3; dim++) {
+		const float left = centerBox.minP[dim];
+		const float extent = centerBox.maxP[dim] - left;
+		if (extent <= 0)
+			continue;
+		const float scale = bucketNum / extent;
+
+		Bucket buckets[maxBucketNum];
+		for (const auto & ref : refs) {
+			auto & bucket = buckets[BucketIdx(ref.box.Center()[dim], left, scale, bucketNum)];
+			bucket.num++;
+			bucket.box.UnionWith(ref.box);
+		}
+
+		BBoxf rightBoxes[maxBucketNum];
+		int rightNum[maxBucketNum];
+		BBoxf accBox;
+		int accNum = 0;
+		for (int i = bucketNum - 1; i > 0; i--) {
+			accBox.UnionWith(buckets[i].box);
+			accNum += buckets[i].num;
+			rightBoxes[i] = accBox;
+			rightNum[i] = accNum;
+		}
+
+		accBox = BBoxf();
+		accNum = 0;
+		for (int i = 1; i < bucketNum; i++) {
+			accBox.UnionWith(buckets[i - 1].box);
+			accNum += buckets[i - 1].num;
+			if (accNum == 0 || rightNum[i] == 0)
+				continue;
+
+			const float curCost = t_trav + accBox.SurfaceArea() * accNum + rightBoxes[i].SurfaceArea() * rightNum[i];
+			if (curCost < cost) {
+				cost = curCost;
+				split = i;
+				axis = dim;
+				leftBox = accBox;
+				rightBox = rightBoxes[i];
+			}
+		}
+	}
+
+	return axis != -1;
+}
+
+bool BVHBuilder::FindSpatialSplit(const vector<Ref> & refs, const BBoxf & box, int & axis, float & pos, float & cost) const {
+	cost = FLT_MAX;
+	axis = -1;
+	for (int dim = 0; dim < 3; dim++) {
+		const float left = box.minP[dim];
+		const float extent = box.maxP[dim] - left;
+		if (extent <= 0)
+			continue;
+		const float scale = bucketNum / extent;
+		const float binWidth = extent / bucketNum;
+
+		// 1. clip refs into the bins they span
+		SpatialBin bins[maxBucketNum];
+		for (const auto & ref : refs) {
+			const int first = BucketIdx(ref.box.minP[dim], left, scale, bucketNum);
+			const int last = BucketIdx(ref.box.maxP[dim], left, scale, bucketNum);
+			bins[first].enterNum++;
+			bins[last].exitNum++;
+
+			BBoxf rest = ref.box;
+			for (int i = first; i < last; i++) {
+				BBoxf binBox;
+				BBoxf rightBox;
+				(*clip)(ref.primIdx, rest, dim, left + (i + 1) * binWidth, binBox, rightBox);
+				bins[i].box.UnionWith(binBox);
+				rest = rightBox;
+			}
+			bins[last].box.UnionWith(rest);
+		}
+
+		// 2. accumulate bins from right, refs are counted on the side they exit
+		float rightArea[maxBucketNum];
+		int rightNum[maxBucketNum];
+		BBoxf accBox;
+		int accNum = 0;
+		for (int i = bucketNum - 1; i > 0; i--) {
+			accBox.UnionWith(bins[i].box);
+			accNum += bins[i].exitNum;
+			rightArea[i] = accBox.SurfaceArea();
+			rightNum[i] = accNum;
+		}
+
+		// 3. sweep from left, refs are counted on the side they enter
+		accBox = BBoxf();
+		accNum = 0;
+		for (int i = 1; i < bucketNum; i++) {
+			accBox.UnionWith(bins[i - 1].box);
+			accNum += bins[i - 1].enterNum;
+			if (accNum == 0 || rightNum[i] == 0)
+				continue;
+
+			const float curCost = t_trav + accBox.SurfaceArea() * accNum + rightArea[i] * rightNum[i];
+			if (curCost < cost) {
+				cost = curCost;
+				pos = left + i * binWidth;
+				axis = dim;
+			}
+		}
+	}
+
+	return axis != -1;
+}
+
+void BVHBuilder::BuildLinear(const vector<BBoxf> & boxes, bool isHLBVH) {
+	this->boxes = &boxes;
+	nodes.clear();
+
+	const int primNum = static_cast<int>(boxes.size());
+	primIndices.resize(primNum);
+	if (primNum == 0) {
+		this->boxes = nullptr;
+		return;
+	}
+
+	const int taskNum = primNum < minParallelNum ? 1 : max(1, static_cast<int>(thread::hardware_concurrency()));
+	const int chunkSize = (primNum + taskNum - 1) / taskNum;
+
+	BBoxf centerBox;
+	for (const auto & box : boxes)
+		centerBox.UnionWith(box.Center());
+
+	// 30 bit codes are enough unless the primitives are more than 2^20
+	const int bitNumPerAxis = primNum <= (1 << 20) ? 10 : 21;
+	const int bitNum = 3 * bitNumPerAxis;
+	const float maxCoord = static_cast<float>((1 << bitNumPerAxis) - 1);
+	float scales[3];
+	for (int axis = 0; axis < 3; axis++) {
+		const float extent = centerBox.maxP[axis] - centerBox.minP[axis];
+		scales[axis] = extent > 0 ? maxCoord / extent : 0.f;
+	}
+	mortonPrims.resize(primNum);
+	ParallelTasks(taskNum, [&](int taskIdx) {
+		const int end = min(primNum, (taskIdx + 1) * chunkSize);
+		for (int i = taskIdx * chunkSize; i < end; i++) {
+			const auto center = boxes[i].Center();
+			uint64_t code = 0;
+			for (int axis = 0; axis < 3; axis++) {
+				// the x bit is the highest of each triple
+				const float coord = Math::Clamp((center[axis] - centerBox.minP[axis]) * scales[axis], 0.f, maxCoord);
+				code |= ExpandBits(static_cast<uint64_t>(coord)) << (2 - axis);
+			}
+			mortonPrims[i] = { code, i };
+		}
+	});
+
+	RadixSort(mortonPrims, bitNum, taskNum);
+	for (int i = 0; i < primNum; i++)
+		primIndices[i] = mortonPrims[i].primIdx;
+
+	if (!isHLBVH)
+		EmitLinear(0, primNum, bitNum - 1, 0, nodes);
+	else {
+		// treelets are the runs of the same top bits
+		const int treeletShift = bitNum - treeletBitNum;
+		vector<int> treeletBegins;
+		for (int i = 0; i < primNum; i++) {
+			if (i == 0 || (mortonPrims[i].code >> treeletShift) != (mortonPrims[i - 1].code >> treeletShift))
+				treeletBegins.push_back(i);
+		}
+		const int treeletNum = static_cast<int>(treeletBegins.size());
+		treeletBegins.push_back(primNum);
+
+		vector<vector<Node>> treeletNodes(treeletNum);
+		vector<BBoxf> treeletBoxes(treeletNum);
+		ParallelTasks(min(taskNum, treeletNum), [&](int taskIdx) {
+			const int stride = min(taskNum, treeletNum);
+			for (int i = taskIdx; i < treeletNum; i += stride) {
+				treeletBoxes[i] = EmitLinear(treeletBegins[i], treeletBegins[i + 1],
+					treeletShift - 1, treeletDepth, treeletNodes[i]);
+			}
+		});
+
+		// binned SAH over the treelets, one treelet per leaf
+		BVHBuilder top(1, bucketNum);
+		top.medianSplitDepth = treeletTopMedianDepth;
+		top.Build(treeletBoxes);
+		AppendTreelets(top, 0, treeletNodes, nodes);
+	}
+
+	mortonPrims.clear();
+	mortonPrims.shrink_to_fit();
+	this->boxes = nullptr;
+}
+
+const BBoxf BVHBuilder::EmitLinear(int begin, int end, int bit, int depth, vector<Node> & nodes) {
+	const int curNodeIdx = static_cast<int>(nodes.size());
+	nodes.push_back(Node());
+
+	const int num = end - begin;
+	if (num <= maxLeafSize) {
+		BBoxf box;
+		for (int i = begin; i < end; i++)
+			box.UnionWith((*boxes)[primIndices[i]]);
+		nodes[curNodeIdx] = { box, begin, num, -1 };
+		return box;
+	}
+
+	// skip the bits on which the whole range agrees, the codes are sorted
+	const uint64_t diff = mortonPrims[begin].code ^ mortonPrims[end - 1].code;
+	while (bit >= 0 && !((diff >> bit) & 1))
+		bit--;
+
+	int mid;
+	int axis;
+	if (depth >= medianSplitDepth || bit < 0) {
+		// same codes, or too deep
+		mid = (begin + end) / 2;
+		axis = 0;
+	}
+	else {
+		const uint64_t mask = 1ull << bit;
+		mid = static_cast<int>(partition_point(mortonPrims.begin() + begin, mortonPrims.begin() + end,
+			[mask](const MortonPrim & prim) { return !(prim.code & mask); }) - mortonPrims.begin());
+		axis = 2 - bit % 3;
+	}
+
+	BBoxf box;
+	int secondChildIdx;
+	if (depth < parallelDepth && num >= minParallelNum) {
+		vector<Node> leftNodes;
+		vector<Node> rightNodes;
+		BBoxf leftBox;
+		auto leftTask = async(launch::async, [&]() {
+			leftBox = EmitLinear(begin, mid, bit - 1, depth + 1, leftNodes);
+		});
+		box = EmitLinear(mid, end, bit - 1, depth + 1, rightNodes);
+		leftTask.get();
+		box.UnionWith(leftBox);
+
+		auto append = [&nodes](const vector<Node> & subNodes) {
+			const int base = static_cast<int>(nodes.size());
+			for (auto node : subNodes) {
+				if (node.num == 0)
+					node.offset += base;
+				nodes.push_back(node);
+			}
+		};
+		append(leftNodes);
+		secondChildIdx = static_cast<int>(nodes.size());
+		append(rightNodes);
+	}
+	else {
+		box = EmitLinear(begin, mid, bit - 1, depth + 1, nodes);
+		secondChildIdx = static_cast<int>(nodes.size());
+		box.UnionWith(EmitLinear(mid, end, bit - 1, depth + 1, nodes));
+	}
+
+	nodes[curNodeIdx] = { box, secondChildIdx, 0, axis };
+	return box;
+}
+
+void BVHBuilder::AppendTreelets(const BVHBuilder & top, int topIdx,
+	const vector<vector<Node>> & treeletNodes, vector<Node> & nodes)
+{
+	const auto & topNode = top.nodes[topIdx];
+	if (topNode.num != 0) {
+		// leaves of the treelet already refer to the global primIndices
+		const int base = static_cast<int>(nodes.size());
+		for (auto node : treeletNodes[top.primIndices[topNode.offset]]) {
+			if (node.num == 0)
+				node.offset += base;
+			nodes.push_back(node);
+		}
+		return;
+	}
+
+	const int curNodeIdx = static_cast<int>(nodes.size());
+	nodes.push_back(topNode);
+	AppendTreelets(top, topIdx + 1, treeletNodes, nodes);
+	nodes[curNodeIdx].offset = static_cast<int>(nodes.size());
+	AppendTreelets(top, topNode.offset, treeletNodes, nodes);
+}
@@ -0,0 +1,124 @@
+#ifndef _CPPUTIL_ENGINE_RTX_BVH_BUILDER_H_
+#define _CPPUTIL_ENGINE_RTX_BVH_BUILDER_H_
+
+#include <CppUtil/Engine/WideBVHNode.h>
+
+#include <CppUtil/Basic/UGM/BBox.h>
+
+#include <vector>
+#include <functional>
+#include <atomic>
+
+namespace CppUtil {
+	namespace Engine {
+		// binned SAH builder over flat arrays of primitive indices, centers and boxes
+		// the top levels are split into tasks running on all cores
+		class BVHBuilder {
+		public:
+			// split the part of primitive primIdx inside box by the plane axis = pos
+			using ClipFunc = std::function<void(int primIdx, const BBoxf & box, int axis, float pos, BBoxf & left, BBoxf & right)>;
+
+			struct Node {
+				BBoxf box;
+				int offset; // leaf: offset of primIndices, interior: second child index
+				int num; // leaf: primitive num, interior: 0
+				int axis; // interior: xyz, leaf: -1
+			};
+
+		public:
+			BVHBuilder(int maxLeafSize = 4, int bucketNum = 12);
+
+		public:
+			// boxes[i] is the world box of primitive i
+			// nodes are stored in depth first order, first child is at nodeIdx + 1
+			// the depth of the tree is at most BVH_MAX_DEPTH
+			void Build(const std::vector<BBoxf> & boxes);
+
+			// SBVH, references of primitives may be split by spatial bins
+			// the references grow at most by splitBudget * boxes.size()
+			void BuildSpatial(const std::vector<BBoxf> & boxes, const ClipFunc & clip, float splitBudget);
+
+			// LBVH, primitives are sorted by the morton codes of their centers and split at the code bits
+			// fast but the tree is worse than the SAH one, for interactive previews
+			// isHLBVH: treelets of the top 12 bits are connected by binned SAH
+			void BuildLinear(const std::vector<BBoxf> & boxes, bool isHLBVH);
+
+			const std::vector<Node> & GetNodes() const { return nodes; }
+
+			// leaf refers to primIndices[offset, offset + num)
+			// a primitive may appear more than once after BuildSpatial
+			const std::vector<int> & GetPrimIndices() const { return primIndices; }
+
+		public:
+			static constexpr float t_trav = 0.125f;
+			static constexpr int maxBucketNum = 32;
+
+		private:
+			struct MortonPrim {
+				uint64_t code;
+				int primIdx;
+			};
+
+			// append the subtree of mortonPrims[begin, end) to nodes, split at bit and below
+			// the box of the subtree root is returned
+			const BBoxf EmitLinear(int begin, int end, int bit, int depth, std::vector<Node> & nodes);
+
+			// append the subtree of top at topIdx to nodes, the leaves are replaced by the treelets
+			static void AppendTreelets(const BVHBuilder & top, int topIdx,
+				const std::vector<std::vector<Node>> & treeletNodes, std::vector<Node> & nodes);
+
+			// append the subtree of primIndices[begin, end) to nodes
+			void BuildRecursive(int begin, int end, int depth, std::vector<Node> & nodes);
+
+			// partition primIndices[begin, end) by binned SAH, return the split position
+			int Partition(int begin, int end, const BBoxf & centerBox, int & axis);
+
+			// split primIndices[begin, end) at the median center along the max extent
+			int MedianSplit(int begin, int end, const BBoxf & centerBox, int & axis);
+
+			// part of a primitive in the spatial build
+			struct Ref {
+				BBoxf box;
+				int primIdx;
+			};
+
+			// append the subtree of refs to nodes and its leaves to indices
+			void BuildSpatialRecursive(std::vector<Ref> & refs, int depth, std::vector<Node> & nodes, std::vector<int> & indices);
+
+			// split refs by the better one of binned object and spatial SAH
+			// median split from BVH_MAX_DEPTH - 32 on, like BuildRecursive
+			void SplitRefs(std::vector<Ref> & refs, int depth, const BBoxf & box, const BBoxf & centerBox,
+				std::vector<Ref> & leftRefs, std::vector<Ref> & rightRefs, int & axis);
+
+			// object split of refs by binned SAH, return false if all centers coincide
+			bool FindObjectSplit(const std::vector<Ref> & refs, const BBoxf & centerBox,
+				int & axis, int & split, float & cost, BBoxf & leftBox, BBoxf & rightBox) const;
+
+			// spatial split of refs by binned SAH over box, return false if none is found
+			bool FindSpatialSplit(const std::vector<Ref> & refs, const BBoxf & box, int & axis, float & pos, float & cost) const;
+
+		private:
+			const int maxLeafSize;
+			const int bucketNum;
+			int parallelDepth;
+			// median splits from this depth on bound the depth of the tree
+			int medianSplitDepth;
+
+			const std::vector<BBoxf> * boxes;
+			std::vector<Point3> centers;
+
+			// linear build, sorted by code
+			std::vector<MortonPrim> mortonPrims;
+
+			// spatial build
+			const ClipFunc * clip;
+			float minOverlapArea;
+			std::atomic<int> remainingSplitNum;
+
+			std::vector<int> primIndices;
+			std::vector<Node> nodes;
+		};
+	}
+}
+
+#endif//!_CPPUTIL_ENGINE_RTX_BVH_BUILDER_H_
@@ -5,28 +5,119 @@
 #include <CppUtil/Engine/Filter.h>
 #include <CppUtil/Basic/Image.h>
 
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+
 using namespace CppUtil;
 using namespace CppUtil::Basic;
 using namespace CppUtil::Engine;
 
 Film::Film(Basic::Ptr<Basic::Image> img, Basic::Ptr<Filter> filter)
 	: resolution(img->GetWidth(), img->GetHeight()),
-	pixels(img->GetWidth(), std::vector<Pixel>(img->GetHeight())),
+	pixels(img->GetWidth(), img->GetHeight()),
 	frame({ 0,0 }, { img->GetWidth(),img->GetHeight() }),
 	filter(filter),
-	img(img)
+	img(img),
+	margin(static_cast<int>(std::ceil(filter->radius.x)), static_cast<int>(std::ceil(filter->radius.y))),
+	rowLocks(img->GetHeight())
 {
 	assert(img != nullptr && img->IsValid());
 	assert(img->GetChannel() == 3);
 }
 
-const Ptr<FilmTile> Film::GenFilmTile(const Framei & frame) const {
-	return FilmTile::New(frame, filter);
+const Ptr<FilmTile> Film::GenFilmTile(const Framei & frame, bool isOddPass) const {
+	const Framei sampleFrame = Framei::Intersect(Framei(frame.minP - margin, frame.maxP + margin), this->frame);
+	return FilmTile::New(frame, sampleFrame, filter, isOddPass);
+}
+
+template<typename Op>
+void Film::ForEachRowSpan(const Framei & tileFrame, const Framei & region, Op op) const {
+	// only the tile itself reaches its pixels away from its border
+	const int ownedX0 = std::min(std::max(tileFrame.minP.x + margin.x, region.minP.x), region.maxP.x);
+	const int ownedX1 = std::max(std::min(tileFrame.maxP.x - margin.x, region.maxP.x), ownedX0);
+	const int ownedY0 = tileFrame.minP.y + margin.y;
+	const int ownedY1 = tileFrame.maxP.y - margin.y;
+
+	for (int y = region.minP.y; y < region.maxP.y; y++) {
+		if (y >= ownedY0 && y < ownedY1) {
+			op(y, ownedX0, ownedX1);
+
+			std::lock_guard<std::mutex> lock(rowLocks[y]);
+			op(y, region.minP.x, ownedX0);
+			op(y, ownedX1, region.maxP.x);
+		}
+		else {
+			std::lock_guard<std::mutex> lock(rowLocks[y]);
+			op(y, region.minP.x, region.maxP.x);
+		}
+	}
 }
 
 void Film::MergeFilmTile(Basic::Ptr<FilmTile> filmTile) {
-	for (const auto pos : filmTile->AllPos()) {
-		pixels[pos.x][pos.y] += filmTile->At(pos);
-		img->SetPixel(pos, pixels[pos.x][pos.y].ToRadiance());
+	const Framei & sampleFrame = filmTile->sampleFrame;
+	const auto & tilePixels = filmTile->pixels;
+	ForEachRowSpan(filmTile->frame, sampleFrame, [&](int y, int x0, int x1) {
+		for (int plane = 0; plane < PixelBuffer::PLANE_NUM; plane++) {
+			float * dst = pixels.Row(plane, y);
+			const float * src = tilePixels.Row(plane, y - sampleFrame.minP.y) - sampleFrame.minP.x;
+			for (int x = x0; x < x1; x++)
+				dst[x] += src[x];
+		}
+	});
+}
+
+void Film::Resolve() {
+	const int width = resolution.x;
+	float * imgData = img->GetData();
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	for (int y = 0; y < resolution.y; y++) {
+		const float * rRow = pixels.Row(PixelBuffer::R, y);
+		const float * gRow = pixels.Row(PixelBuffer::G, y);
+		const float * bRow = pixels.Row(PixelBuffer::B, y);
+		const float * wRow = pixels.Row(PixelBuffer::W, y);
+		float * dst = imgData + y * width * 3;
+
+		int x = 0;
+		for (; x + 4 <= width; x += 4) {
+			// pixels without weight stay black
+			const __m128 weight = _mm_loadu_ps(wRow + x);
+			const __m128 invWeight = _mm_and_ps(_mm_div_ps(one, weight), _mm_cmpneq_ps(weight, zero));
+			const __m128 r = _mm_mul_ps(_mm_loadu_ps(rRow + x), invWeight);
+			const __m128 g = _mm_mul_ps(_mm_loadu_ps(gRow + x), invWeight);
+			const __m128 b = _mm_mul_ps(_mm_loadu_ps(bRow + x), invWeight);
+
+			// r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3
+			const __m128 rgLo = _mm_unpacklo_ps(r, g); // r0 g0 r1 g1
+			const __m128 rgHi = _mm_unpackhi_ps(r, g); // r2 g2 r3 g3
+			const __m128 b0b0r1g1 = _mm_shuffle_ps(b, rgLo, _MM_SHUFFLE(3, 2, 0, 0));
+			const __m128 g1g1b1b1 = _mm_shuffle_ps(rgLo, b, _MM_SHUFFLE(1, 1, 3, 3));
+			const __m128 b2b3r3g3 = _mm_shuffle_ps(b, rgHi, _MM_SHUFFLE(3, 2, 3, 2));
+			_mm_storeu_ps(dst + 3 * x, _mm_shuffle_ps(rgLo, b0b0r1g1, _MM_SHUFFLE(2, 0, 1, 0)));
+			_mm_storeu_ps(dst + 3 * x + 4, _mm_shuffle_ps(g1g1b1b1, rgHi, _MM_SHUFFLE(1, 0, 2, 0)));
+			_mm_storeu_ps(dst + 3 * x + 8, _mm_shuffle_ps(b2b3r3g3, b2b3r3g3, _MM_SHUFFLE(1, 3, 2, 0)));
+		}
+
+		for (; x < width; x++) {
+			const RGBf radiance = pixels.ToRadiance(x, y);
+			dst[3 * x] = radiance.r;
+			dst[3 * x + 1] = radiance.g;
+			dst[3 * x + 2] = radiance.b;
+		}
 	}
 }
+
+float Film::Error(const Framei & frame) const {
+	float errorSum = 0.f;
+	ForEachRowSpan(frame, frame, [&](int y, int x0, int x1) {
+		for (int x = x0; x < x1; x++) {
+			const float I = pixels.ToRadiance(x, y).Illumination();
+			const float O = pixels.ToOddRadiance(x, y).Illumination();
+			// dark pixels are not divided by a tiny number
+			errorSum += std::abs(I - O) / std::sqrt(std::max(I, 0.01f));
+		}
+	});
+
+	return errorSum / std::max(frame.Area(), 1);
+}
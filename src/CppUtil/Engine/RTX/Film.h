@@ -9,6 +9,7 @@
 #include <CppUtil/Basic/Array2D.h>
 #include <CppUtil/Basic/UGM/Frame.h>
 #include <vector>
+#include <mutex>
 
 namespace CppUtil {
 	namespace Basic {
@@ -32,39 +33,82 @@ namespace CppUtil {
 			}
 
 		public:
-			const Basic::Ptr<FilmTile> GenFilmTile(const Framei & frame) const;
+			// the samples of the pixels in frame, they reach the pixels around within the radius of the filter
+			// samples of odd passes are also summed alone, for the error estimate
+			const Basic::Ptr<FilmTile> GenFilmTile(const Framei & frame, bool isOddPass = false) const;
+
+			// the pixels of the tile which no other tile reaches are added without locks,
+			// the rows of the border which other tiles reach are locked
+			// a tile must not be merged by two threads at the same time
 			void MergeFilmTile(Basic::Ptr<FilmTile> filmTile);
 
+			// radiance of all the pixels to the image, 4 pixels at a time
+			// it is meant to run at display rate, not after every merge
+			// a pixel being merged meanwhile shows the sums before or after the merge
+			void Resolve();
+
+			// mean of |I - O| / sqrt(I) over the pixels of frame, I of all the samples and O of the odd passes
+			// with as many odd passes as even ones, it tracks the error of I
+			// Dammertz et al., A Hierarchical Automatic Stopping Condition for Monte Carlo Global Illumination, 2010
+			float Error(const Framei & frame) const;
+
 		private:
 			friend class FilmTile;
 
-			struct Pixel {
-				Pixel() : weightRadianceSum(0.f), filterWeightSum(0.f) { }
-
-				RGBf weightRadianceSum;
-				float filterWeightSum;
+			// sums of the samples in SoA form, one contiguous block of planes, each plane row-major
+			class PixelBuffer {
+			public:
+				enum Plane {
+					R, G, B, // weighted radiance
+					W, // filter weight
+					OddR, OddG, OddB, OddW, // samples of the odd passes only
+					PLANE_NUM
+				};
+
+			public:
+				PixelBuffer(int width, int height)
+					: width(width), height(height), data(PLANE_NUM * width * height, 0.f) { }
+
+			public:
+				float * Row(int plane, int y) { return data.data() + (plane * height + y) * width; }
+				const float * Row(int plane, int y) const { return data.data() + (plane * height + y) * width; }
+
+				const RGBf ToRadiance(int x, int y) const { return ToRadiance(x, y, R); }
+				const RGBf ToOddRadiance(int x, int y) const { return ToRadiance(x, y, OddR); }
+
+			private:
+				const RGBf ToRadiance(int x, int y, int firstPlane) const {
+					const float weight = Row(firstPlane + 3, y)[x];
+					if (weight == 0)
+						return RGBf(0.f);
 
-				Pixel & operator+=(const Pixel & pixel) {
-					weightRadianceSum += pixel.weightRadianceSum;
-					filterWeightSum += pixel.filterWeightSum;
-					return *this;
+					return RGBf(Row(firstPlane, y)[x], Row(firstPlane + 1, y)[x], Row(firstPlane + 2, y)[x]) / weight;
 				}
 
-				const RGBf ToRadiance() const {
-					if (filterWeightSum == 0)
-						return RGBf(0.f);
+			public:
+				const int width;
+				const int height;
 
-					return weightRadianceSum / filterWeightSum;
-				}
+			private:
+				std::vector<float> data;
 			};
 
+			// op(y, x0, x1) for the spans of the rows of region, region is within the sample frame of the tile at tileFrame
+			// pixels closer to the border of the tile than margin may be reached by other tiles, so their spans are locked
+			template<typename Op>
+			void ForEachRowSpan(const Framei & tileFrame, const Framei & region, Op op) const;
+
 		private:
 			Basic::Ptr<Basic::Image> img;
 			const Point2i resolution;
-			std::vector<std::vector<Pixel>> pixels;
+			PixelBuffer pixels;
 
 			const Framei frame; // ϵı߽
 			Basic::Ptr<Filter> filter;
+
+			// pixels a sample reaches beyond its own
+			const Vec2i margin;
+			mutable std::vector<std::mutex> rowLocks;
 		};
 	}
 }
@@ -2,38 +2,81 @@
 
 #include <CppUtil/Engine/Filter.h>
 
+#include <immintrin.h>
+#include <cmath>
+
 using namespace CppUtil;
 using namespace CppUtil::Basic;
 using namespace CppUtil::Engine;
 
-const Framei FilmTile::SampleFrame() const {
-	auto minP = static_cast<Point2i>(frame[0] + Vec2f(0.5f) - filter->radius);
-	auto maxP = static_cast<Point2i>(frame[1] - Vec2f(0.5f) + filter->radius); // Ϊ frame ϱ߽磬Ǽȥ
-	return Framei(minP, maxP);
+namespace {
+	void Add4(float * dst, const __m128 & val) {
+		_mm_storeu_ps(dst, _mm_add_ps(_mm_loadu_ps(dst), val));
+	}
 }
 
 void FilmTile::AddSample(const Point2f & pos, const RGBf & radiance) {
 	if (radiance.HasNaN())
 		return;
 
+	// pixels whose centers are within the radius
 	const auto minP = pos - filter->radius;
 	const auto maxP = pos + filter->radius;
 
-	const int x0 = std::max(static_cast<int>(minP.x + 0.5f), frame.minP.x);
-	const int x1 = std::min(static_cast<int>(maxP.x - 0.5f), frame.maxP.x);
+	const int x0 = std::max(static_cast<int>(std::ceil(minP.x - 0.5f)), sampleFrame.minP.x);
+	const int x1 = std::min(static_cast<int>(std::floor(maxP.x - 0.5f)) + 1, sampleFrame.maxP.x);
+
+	const int y0 = std::max(static_cast<int>(std::ceil(minP.y - 0.5f)), sampleFrame.minP.y);
+	const int y1 = std::min(static_cast<int>(std::floor(maxP.y - 0.5f)) + 1, sampleFrame.maxP.y);
 
-	const int y0 = std::max(static_cast<int>(minP.y + 0.5f), frame.minP.y);
-	const int y1 = std::min(static_cast<int>(maxP.y - 0.5f), frame.maxP.y);
+	// the filter is separable, so a look up per column and one per row give the weights
+	const int num = x1 - x0;
+	for (int i = 0; i < num; i++)
+		weightsX[i] = filter->LookUp1D(pos.x - (x0 + i + 0.5f), 0);
 
-	const int width = frame.maxP.x - frame.minP.x;
-	for (int x = x0; x < x1; x++) {
-		int idxX = x - frame.minP.x;
-		for (int y = y0; y < y1; y++) {
-			int idxY = y - frame.minP.y;
+	const __m128 r = _mm_set1_ps(radiance.r);
+	const __m128 g = _mm_set1_ps(radiance.g);
+	const __m128 b = _mm_set1_ps(radiance.b);
+	for (int y = y0; y < y1; y++) {
+		const int idxY = y - sampleFrame.minP.y;
+		float * rows[Film::PixelBuffer::PLANE_NUM];
+		for (int plane = 0; plane < Film::PixelBuffer::PLANE_NUM; plane++)
+			rows[plane] = pixels.Row(plane, idxY) + (x0 - sampleFrame.minP.x);
+
+		const float weightY = filter->LookUp1D(pos.y - (y + 0.5f), 1);
+		const __m128 weightY4 = _mm_set1_ps(weightY);
+
+		// 4 pixels of the row at a time
+		int i = 0;
+		for (; i + 4 <= num; i += 4) {
+			const __m128 weight = _mm_mul_ps(_mm_loadu_ps(&weightsX[i]), weightY4);
+			const __m128 weightR = _mm_mul_ps(weight, r);
+			const __m128 weightG = _mm_mul_ps(weight, g);
+			const __m128 weightB = _mm_mul_ps(weight, b);
+			Add4(rows[Film::PixelBuffer::R] + i, weightR);
+			Add4(rows[Film::PixelBuffer::G] + i, weightG);
+			Add4(rows[Film::PixelBuffer::B] + i, weightB);
+			Add4(rows[Film::PixelBuffer::W] + i, weight);
+			if (isOddPass) {
+				Add4(rows[Film::PixelBuffer::OddR] + i, weightR);
+				Add4(rows[Film::PixelBuffer::OddG] + i, weightG);
+				Add4(rows[Film::PixelBuffer::OddB] + i, weightB);
+				Add4(rows[Film::PixelBuffer::OddW] + i, weight);
+			}
+		}
 
-			const auto weight = filter->Evaluate(pos - (Vec2(x, y) + Vec2(0.5f)));
-			pixels[idxX][idxY].filterWeightSum += weight;
-			pixels[idxX][idxY].weightRadianceSum += weight * radiance;
+		for (; i < num; i++) {
+			const float weight = weightsX[i] * weightY;
+			rows[Film::PixelBuffer::R][i] += weight * radiance.r;
+			rows[Film::PixelBuffer::G][i] += weight * radiance.g;
+			rows[Film::PixelBuffer::B][i] += weight * radiance.b;
+			rows[Film::PixelBuffer::W][i] += weight;
+			if (isOddPass) {
+				rows[Film::PixelBuffer::OddR][i] += weight * radiance.r;
+				rows[Film::PixelBuffer::OddG][i] += weight * radiance.g;
+				rows[Film::PixelBuffer::OddB][i] += weight * radiance.b;
+				rows[Film::PixelBuffer::OddW][i] += weight;
+			}
 		}
 	}
 }
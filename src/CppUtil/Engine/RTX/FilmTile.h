@@ -7,45 +7,41 @@ namespace CppUtil {
 	namespace Engine {
 		class FilmTile : public Basic::HeapObj {
 		public:
-			FilmTile(const Framei & frame, Basic::Ptr<Filter> filter)
+			// samples are taken in frame, the sums cover sampleFrame
+			FilmTile(const Framei & frame, const Framei & sampleFrame, Basic::Ptr<Filter> filter, bool isOddPass = false)
 				: frame(frame),
+				sampleFrame(sampleFrame),
 				filter(filter),
-				pixels(frame.Diagonal().x, std::vector<Film::Pixel>(frame.Diagonal().y)) { }
+				isOddPass(isOddPass),
+				pixels(sampleFrame.Diagonal().x, sampleFrame.Diagonal().y),
+				weightsX(sampleFrame.Diagonal().x) { }
 
 		protected:
 			virtual ~FilmTile() = default;
 
 		public:
-			// Frame ϱ߽
-			const Framei SampleFrame() const;
-
 			void AddSample(const Point2f & pos, const RGBf & radiance);
 
+			// Frame ϱ߽
 			const Framei GetFrame() const { return frame; }
-			const std::vector<Point2i> AllPos() const {
-				std::vector<Point2i> posArr;
-				posArr.reserve(frame.Area());
-				for (int x = frame.minP.x; x < frame.maxP.x; x++) {
-					for (int y = frame.minP.y; y < frame.maxP.y; y++) {
-						posArr.push_back({ x,y });
-					}
-				}
-				return posArr;
-			}
-			const Film::Pixel & At(const Point2i & pos) const {
-				assert(pos.x >= frame.minP.x && pos.x < frame.maxP.x);
-				assert(pos.y >= frame.minP.y && pos.y < frame.maxP.y);
-				return pixels[pos.x - frame.minP.x][pos.y - frame.minP.y];
-			}
+			// frame and the pixels around which its samples reach, within the film
+			const Framei GetSampleFrame() const { return sampleFrame; }
 
 		public:
-			static Basic::Ptr<FilmTile> New(const Framei & frame, Basic::Ptr<Filter> filter) {
-				return Basic::New<FilmTile>(frame, filter);
+			static Basic::Ptr<FilmTile> New(const Framei & frame, const Framei & sampleFrame, Basic::Ptr<Filter> filter, bool isOddPass = false) {
+				return Basic::New<FilmTile>(frame, sampleFrame, filter, isOddPass);
 			}
 
 		private:
+			friend class Film;
+
 			const Framei frame;
-			std::vector<std::vector<Film::Pixel>> pixels;
+			const Framei sampleFrame;
+			const bool isOddPass;
+			// indexed from the min corner of sampleFrame
+			Film::PixelBuffer pixels;
+			// filter weights of the columns of the footprint of a sample
+			std::vector<float> weightsX;
 
 			Basic::Ptr<Filter> filter;
 		};
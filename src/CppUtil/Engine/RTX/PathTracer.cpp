@@ -24,6 +24,8 @@ using namespace std;
 PathTracer::PathTracer()
 	:
 	maxDepth(20),
+	lightSampleMode(LightSampler::Mode::BVH),
+	lightSampler(LightSampler::New()),
 	rayIntersector(RayIntersector::New()),
 	visibilityChecker(VisibilityChecker::New())
 { }
@@ -51,13 +53,116 @@ void PathTracer::Init(Ptr<Scene> scene, Ptr<BVHAccel> bvhAccel) {
 		worldToLightVec.push_back(worldToLight);
 		lightToWorldVec.push_back(lightToWorld);
 	}
+
+	lightSampler->SetMode(lightSampleMode);
+	lightSampler->Init(lights, lightToWorldVec, worldToLightVec);
 }
 
 const RGBf PathTracer::Trace(ERay & ray, int depth, RGBf pathThroughput) {
-	rayIntersector->Init(&ray);
-	bvhAccel->Accept(rayIntersector);
-	auto closestRst = rayIntersector->GetRst();
-	if (!closestRst.closestSObj) {
+	auto & state = pathState;
+	// a path has at most maxDepth - depth vertices
+	if (static_cast<int>(state.vertices.size()) < max(maxDepth, 1))
+		state.vertices.resize(max(maxDepth, 1));
+
+	state.ray = ray;
+	state.pathThroughput = pathThroughput;
+	auto & hit = state.hit;
+
+	// random numbers are drawn in the order of the recursion: light sample, then bsdf sample of each bounce
+	int vertexNum = 0;
+	for (;;) {
+		auto & vertex = state.vertices[vertexNum++];
+		vertex.lightL = RGBf(0.f);
+		vertex.weight = RGBf(0.f);
+
+		rayIntersector->Init(&state.ray);
+		rayIntersector->Intersect(*bvhAccel);
+
+		vertex.emitL = BeginShade(state.ray, rayIntersector->GetRst(), depth, hit);
+		vertex.hasSurface = hit.bsdf != nullptr;
+		if (!vertex.hasSurface)
+			break;
+
+		// SampleLightMode mode = depth > 0 ? SampleLightMode::RandomOne : SampleLightMode::ALL;
+		SampleLightMode mode = SampleLightMode::RandomOne;
+		StartSampleStage(depth, LIGHT_SAMPLE_DIM);
+		vertex.lightL = SampleLight(hit.pos, hit.worldToSurface, hit.bsdf, hit.w_out, hit.texcoord, SampleLightMode::RandomOne);
+
+		// hit.pos is the origin of the next ray
+		StartSampleStage(depth, BSDF_SAMPLE_DIM);
+		if (!SampleNextRay(hit.bsdf, mode, hit.w_out, hit.surfaceToWorld, hit.texcoord, hit.pos, depth, state.pathThroughput, state.ray, vertex.weight))
+			break;
+
+		state.pathThroughput = state.pathThroughput * vertex.weight;
+		depth++;
+	}
+
+	// emitL + lightL + weight * (radiance of the next vertex), as the recursion sums it
+	RGBf L(0.f);
+	for (int i = vertexNum - 1; i >= 0; i--) {
+		const auto & vertex = state.vertices[i];
+		L = vertex.hasSurface ? vertex.emitL + vertex.lightL + vertex.weight * L : vertex.emitL;
+	}
+
+	hit.bsdf = nullptr;
+	return L;
+}
+
+void PathTracer::Trace(ERay * rays, const Point2i * pixels, const int sampleIdx, const int num, RGBf * radiances) {
+	for (int first = 0; first < num; first += RAY_PACKET_SIZE)
+		TracePacket(rays + first, pixels + first, sampleIdx, min(RAY_PACKET_SIZE, num - first), radiances + first);
+}
+
+void PathTracer::TracePacket(ERay * rays, const Point2i * pixels, const int sampleIdx, const int num, RGBf * radiances) {
+	RayIntersector::Rst rsts[RAY_PACKET_SIZE];
+	rayIntersector->IntersectPacket(*bvhAccel, rays, num, rsts);
+
+	SurfaceHit hits[RAY_PACKET_SIZE];
+	for (int i = 0; i < num; i++)
+		radiances[i] = BeginShade(rays[i], rsts[i], 0, hits[i]);
+
+	// light samples of the packet start at nearby points, so the shadow rays are tested as a packet too
+	ERay shadowRays[RAY_PACKET_SIZE];
+	RGBf lightLs[RAY_PACKET_SIZE];
+	int shadowRayIdx[RAY_PACKET_SIZE];
+	int shadowRayNum = 0;
+	for (int i = 0; i < num; i++) {
+		if (!hits[i].bsdf)
+			continue;
+
+		const auto & hit = hits[i];
+		StartPixelSample(pixels[i], sampleIdx);
+		StartSampleStage(0, LIGHT_SAMPLE_DIM);
+		lightLs[shadowRayNum] = SampleRandomLight(hit.pos, hit.worldToSurface, hit.bsdf, hit.w_out, hit.texcoord, shadowRays[shadowRayNum]);
+		if (lightLs[shadowRayNum].IsZero())
+			continue;
+
+		shadowRayIdx[shadowRayNum] = i;
+		shadowRayNum++;
+	}
+
+	const int occludedMask = shadowRayNum > 0 ? visibilityChecker->IntersectPacket(*bvhAccel, shadowRays, shadowRayNum) : 0;
+	for (int k = 0; k < shadowRayNum; k++) {
+		if (!(occludedMask & (1 << k)))
+			radiances[shadowRayIdx[k]] += lightLs[k];
+	}
+
+	// the bounces diverge, ray by ray
+	for (int i = 0; i < num; i++) {
+		if (!hits[i].bsdf)
+			continue;
+
+		const auto & hit = hits[i];
+		StartPixelSample(pixels[i], sampleIdx);
+		StartSampleStage(0, BSDF_SAMPLE_DIM);
+		radiances[i] += SampleBSDF(hit.bsdf, SampleLightMode::RandomOne, hit.w_out, hit.surfaceToWorld, hit.texcoord, hit.pos, 0, RGBf(1.f));
+	}
+}
+
+const RGBf PathTracer::BeginShade(const ERay & ray, const RayIntersector::Rst & rst, const int depth, SurfaceHit & hit) const {
+	hit.bsdf = nullptr;
+
+	if (!rst.closestSObj) {
 		RGBf Le(0.f);
 		for (auto light : lights)
 			Le += light->Le(ray);
@@ -65,33 +170,34 @@ const RGBf PathTracer::Trace(ERay & ray, int depth, RGBf pathThroughput) {
 		return Le;
 	}
 
-	const Point3 hitPos = ray.EndPos();
-
-	auto cmptMaterial = closestRst.closestSObj->GetComponent<CmptMaterial>();
+	auto cmptMaterial = rst.closestSObj->GetComponent<CmptMaterial>();
 	if (!cmptMaterial || !cmptMaterial->material)
 		return RGBf(0);
 
-	auto bsdf = dynamic_pointer_cast<BSDF>(cmptMaterial->material);
+	// no reference counting per bounce, the material is kept by the scene
+	auto bsdf = dynamic_cast<BSDF *>(cmptMaterial->material.get());
 	if (bsdf == nullptr)
 		return Vec3f(0);
 
-	bsdf->ChangeNormal(closestRst.texcoord, closestRst.tangent, closestRst.n);
+	Normalf n = rst.n;
+	bsdf->ChangeNormal(rst.texcoord, rst.tangent, n);
 
-	const auto surfaceToWorld = closestRst.n.GenCoordSpace();
-	const auto worldToSurface = surfaceToWorld.Transpose();
+	hit.bsdf = bsdf;
+	hit.pos = ray.EndPos();
+	hit.surfaceToWorld = n.GenCoordSpace();
+	hit.worldToSurface = hit.surfaceToWorld.Transpose();
+	hit.texcoord = rst.texcoord;
 
 	// w_out ڱϵ
-	const Normalf w_out = (worldToSurface * (-ray.d)).Normalize();
-
-	RGBf emitL = depth == 0 ? bsdf->Emission(w_out) : RGBf(0);
-
-	// SampleLightMode mode = depth > 0 ? SampleLightMode::RandomOne : SampleLightMode::ALL;
-	SampleLightMode mode = SampleLightMode::RandomOne;
-	const RGBf lightL = SampleLight(hitPos, worldToSurface, bsdf, w_out, closestRst.texcoord, SampleLightMode::RandomOne);
+	hit.w_out = (hit.worldToSurface * (-ray.d)).Normalize();
 
-	const RGBf matL = SampleBSDF(bsdf, mode, w_out, surfaceToWorld, closestRst.texcoord, hitPos, depth, pathThroughput);
+	return depth == 0 ? bsdf->Emission(hit.w_out) : RGBf(0);
+}
 
-	return emitL + lightL + matL;
+bool PathTracer::IsOccluded(const ERay & shadowRay) const {
+	visibilityChecker->Init(shadowRay, shadowRay.tMax);
+	visibilityChecker->Intersect(*bvhAccel);
+	return visibilityChecker->GetRst().IsIntersect();
 }
 
 const RGBf PathTracer::SampleLightImpl(
@@ -99,15 +205,16 @@ const RGBf PathTracer::SampleLightImpl(
 	const Point3 & posInWorldSpace,
 	const Point3 & posInLightSpace,
 	const Mat3f & worldToSurface,
-	const Basic::Ptr<BSDF> bsdf,
+	BSDF * const bsdf,
 	const Normalf & w_out,
 	const Point2 & texcoord,
-	float factorPD
+	const SampleLightMode mode,
+	float factorPD,
+	ERay & shadowRay
 ) const
 {
 	auto const light = lights[lightID];
 	auto const & lightToWorld = lightToWorldVec[lightID];
-	const int lightNum = static_cast<int>(lights.size());
 
 	float dist_ToLight;
 	float PD;// ܶ
@@ -129,21 +236,14 @@ const RGBf PathTracer::SampleLightImpl(
 		return RGBf(0.f);
 
 	// shadow ray 
-	ERay shadowRay(posInWorldSpace, dirInWorld);
-	visibilityChecker->Init(shadowRay, dist_ToLight - 0.001f);
-	bvhAccel->Accept(visibilityChecker);
-	auto shadowRst = visibilityChecker->GetRst();
-	if (shadowRst.IsIntersect())
-		return RGBf(0);
+	// its occlusion is tested by the caller
+	shadowRay = ERay(posInWorldSpace, dirInWorld);
+	shadowRay.tMax = dist_ToLight - 0.001f;
 
 	// ҪԲ Multiple Importance Sampling (MIS)
+	// the other lights are weighted by the probabilities to pick them at posInWorldSpace
 	if (!light->IsDelta()) {
-		for (int k = 0; k < lightNum; k++) {
-			if (k != lightID && !lights[k]->IsDelta()) {
-				const auto dirInLight = worldToLightVec[k](dirInWorld).Normalize();
-				PD += lights[k]->PDF(posInLightSpace, dirInLight) * factorPD;
-			}
-		}
+		PD += lightSampler->PDF(posInWorldSpace, dirInWorld, lightID, mode == SampleLightMode::RandomOne);
 		PD += bsdf->PDF(w_out, w_in, texcoord);
 	}
 
@@ -154,7 +254,7 @@ const RGBf PathTracer::SampleLightImpl(
 const RGBf PathTracer::SampleLight(
 	const Point3 & posInWorldSpace,
 	const Mat3f & worldToSurface,
-	const Basic::Ptr<BSDF> bsdf,
+	BSDF * const bsdf,
 	const Normalf & w_out,
 	const Point2 & texcoord,
 	const SampleLightMode mode
@@ -171,15 +271,19 @@ const RGBf PathTracer::SampleLight(
 	case SampleLightMode::ALL: {
 		for (int i = 0; i < lightNum; i++) {
 			auto posInLightSpace = worldToLightVec[i](posInWorldSpace);
-			rst += SampleLightImpl(i, posInWorldSpace, posInLightSpace, worldToSurface, bsdf, w_out, texcoord, 1.f);
+			ERay shadowRay;
+			const RGBf lightL = SampleLightImpl(i, posInWorldSpace, posInLightSpace, worldToSurface, bsdf, w_out, texcoord, mode, 1.f, shadowRay);
+			if (!lightL.IsZero() && !IsOccluded(shadowRay))
+				rst += lightL;
 		}
 
 		break;
 	}
 	case SampleLightMode::RandomOne: {
-		int lightID = Math::Rand_I() % lightNum;
-		auto posInLightSpace = worldToLightVec[lightID](posInWorldSpace);
-		rst = SampleLightImpl(lightID, posInWorldSpace, posInLightSpace, worldToSurface, bsdf, w_out, texcoord, 1.f / lightNum);
+		ERay shadowRay;
+		rst = SampleRandomLight(posInWorldSpace, worldToSurface, bsdf, w_out, texcoord, shadowRay);
+		if (!rst.IsZero() && IsOccluded(shadowRay))
+			rst = RGBf(0.f);
 		break;
 	}
 	}
@@ -187,8 +291,29 @@ const RGBf PathTracer::SampleLight(
 	return rst;
 }
 
+const RGBf PathTracer::SampleRandomLight(
+	const Point3 & posInWorldSpace,
+	const Mat3f & worldToSurface,
+	BSDF * const bsdf,
+	const Normalf & w_out,
+	const Point2 & texcoord,
+	ERay & shadowRay
+) const
+{
+	if (bsdf->IsDelta())
+		return RGBf(0.f);
+
+	float pmf;
+	const int lightID = lightSampler->Sample(posInWorldSpace, Rand1D(), pmf);
+	if (lightID == -1)
+		return RGBf(0.f);
+
+	auto posInLightSpace = worldToLightVec[lightID](posInWorldSpace);
+	return SampleLightImpl(lightID, posInWorldSpace, posInLightSpace, worldToSurface, bsdf, w_out, texcoord, SampleLightMode::RandomOne, pmf, shadowRay);
+}
+
 const RGBf PathTracer::SampleBSDF(
-	const Basic::Ptr<BSDF> bsdf,
+	BSDF * const bsdf,
 	const SampleLightMode mode,
 	const Normalf & w_out,
 	const Mat3f & surfaceToWorld,
@@ -198,53 +323,54 @@ const RGBf PathTracer::SampleBSDF(
 	RGBf pathThroughput
 )
 {
-	if (depth + 1 >= maxDepth)
+	ERay matRay;
+	RGBf weight;
+	if (!SampleNextRay(bsdf, mode, w_out, surfaceToWorld, texcoord, hitPos, depth, pathThroughput, matRay, weight))
 		return RGBf(0.f);
 
+	const RGBf matRayColor = Trace(matRay, depth + 1, pathThroughput * weight);
+
+	return weight * matRayColor;
+}
+
+bool PathTracer::SampleNextRay(
+	BSDF * const bsdf,
+	const SampleLightMode mode,
+	const Normalf & w_out,
+	const Mat3f & surfaceToWorld,
+	const Point2 & texcoord,
+	const Point3 & hitPos,
+	const int depth,
+	const RGBf & pathThroughput,
+	ERay & matRay,
+	RGBf & weight
+) const
+{
+	if (depth + 1 >= maxDepth)
+		return false;
+
 	Normalf mat_w_in;
 	float matPD;
 	const RGBf matF = bsdf->Sample_f(w_out, texcoord, mat_w_in, matPD);
 	if (matPD <= 0)
-		return RGBf(0);
+		return false;
 
 	const Normalf matRayDirInWorld = (surfaceToWorld * mat_w_in).Normalize();
-	const int lightNum = static_cast<int>(lights.size());
 
 	// MSI
 	float sumPD = matPD;
-	if (!bsdf->IsDelta()) {
-		float scaleFactor;
-		switch (mode)
-		{
-		case SampleLightMode::ALL:
-			scaleFactor = 1.f;
-			break;
-		case SampleLightMode::RandomOne:
-			scaleFactor = 1.f / lightNum;
-			break;
-		}
-
-		for (int i = 0; i < lightNum; i++) {
-			if (lights[i]->IsDelta())
-				continue;
-
-			auto posInLightSpace = worldToLightVec[i](hitPos);
-			Normalf dirInLight = worldToLightVec[i](matRayDirInWorld);
-			sumPD += lights[i]->PDF(posInLightSpace, dirInLight) * scaleFactor;
-		}
-	}
+	if (!bsdf->IsDelta())
+		sumPD += lightSampler->PDF(hitPos, matRayDirInWorld, -1, mode == SampleLightMode::RandomOne);
 
 	// material ray
-	ERay matRay(hitPos, matRayDirInWorld);
+	matRay = ERay(hitPos, matRayDirInWorld);
 
 	// Russian Roulette
 	const RGBf matWeight = abs(mat_w_in.z) / sumPD * matF;
-	pathThroughput *= matWeight;
-	float continueP = bsdf->IsDelta() ? 1.f : min(1.f, pathThroughput.Illumination());
-	if (Math::Rand_F() > continueP)
-		return RGBf(0.f);
-
-	const RGBf matRayColor = Trace(matRay, depth + 1, pathThroughput / continueP);
+	float continueP = bsdf->IsDelta() ? 1.f : min(1.f, (pathThroughput * matWeight).Illumination());
+	if (Rand1D() > continueP)
+		return false;
 
-	return matWeight / continueP * matRayColor;
+	weight = matWeight / continueP;
+	return true;
 }
@@ -3,6 +3,7 @@
 #include <CppUtil/Engine/Scene.h>
 #include <CppUtil/Engine/SObj.h>
 #include <CppUtil/Engine/RayTracer.h>
+#include <CppUtil/Engine/RayIntersector.h>
 #include <CppUtil/Engine/CmptCamera.h>
 #include <CppUtil/Engine/SObj.h>
 #include <CppUtil/Engine/Ray.h>
@@ -13,6 +14,10 @@
 
 #include <omp.h>
 
+#include <algorithm>
+#include <thread>
+#include <climits>
+
 #include "Film.h"
 #include "FilmTile.h"
 #include <CppUtil/Engine/BVHAccel.h>
@@ -30,71 +35,24 @@ using namespace CppUtil::Engine;
 using namespace CppUtil::Basic;
 using namespace std;
 
-namespace CppUtil {
-	namespace Engine {
-		class TileTask{
-		public:
-			TileTask(int tileNum, int maxLoop)
-				: tileNum(tileNum), maxLoop(maxLoop), curTile(0), curLoop(0) { }
-
-		public:
-			void Init(int tileNum, int maxLoop) {
-				this->tileNum = tileNum;
-				this->maxLoop = maxLoop;
-				curTile = 0;
-				curLoop = 0;
-			}
-
-		public:
-			struct Task {
-				Task(bool hasTask, int tileID = -1, int curLoop = -1)
-					: hasTask(hasTask), tileID(tileID), curLoop(curLoop) { }
-
-				bool hasTask;
-				int tileID;
-				int curLoop;
-			};
-			static constexpr int ERROR = -1;
-			const Task GetTask() {
-				if (curLoop == maxLoop)
-					return Task(false);
-				
-				m.lock();
-				auto rst = Task(true, curTile, curLoop);
-				curTile++;
-				if (curTile == tileNum) {
-					curTile = 0;
-					curLoop += 1;
-				}
-				m.unlock();
-
-				return rst;
-			}
-
-			int GetCurLoop() const {
-				return curLoop;
-			}
-
-		private:
-			int tileNum;
-			int curTile;
-			int maxLoop;
-			int curLoop;
-			mutex m;
-		};
-	}
-}
-
 RTX_Renderer::RTX_Renderer(const function<Ptr<RayTracer>()> & generator)
 	:
 	generator(generator),
 	bvhAccel(BVHAccel::New()),
 	state(RendererState::Stop),
 	maxLoop(200),
+	errorThreshold(0.f),
+	minLoop(16),
+	timeBudget(0.0),
+	tileSize(64),
 	threadNum(THREAD_NUM)
 {
 }
 
+void RTX_Renderer::SetBVHCacheDir(const string & dir) {
+	bvhAccel->SetCacheDir(dir);
+}
+
 void RTX_Renderer::Run(Ptr<Scene> scene, Ptr<Image> img) {
 	state = RendererState::Running;
 
@@ -115,7 +73,8 @@ void RTX_Renderer::Run(Ptr<Scene> scene, Ptr<Image> img) {
 		rayTracers.push_back(rayTracer);
 	}
 	
-	bvhAccel->Init(scene->GetRoot());
+	// refits when only transforms changed since the last run
+	bvhAccel->Update(scene->GetRoot());
 	// init ray tracer
 	for (auto rayTracer : rayTracers)
 		rayTracer->Init(scene, bvhAccel);
@@ -132,38 +91,85 @@ void RTX_Renderer::Run(Ptr<Scene> scene, Ptr<Image> img) {
 	camera->InitCoordinate();
 
 	// jobs
-	const int tileSize = 64;
-	const int rowTiles = w / tileSize;
-	const int tileNum = w * h / (tileSize*tileSize);
-	tileTask.Init(tileNum, maxLoop);
-
-	// init float image
-	int imgSize = w * h;
-	vector<vector<RGBf>> imgTiles(tileNum, vector<RGBf>(tileSize*tileSize, RGBf(0.f)));
-
+	const int tileSize = max(static_cast<int>(this->tileSize), 1);
+	// packetSize * packetSize <= RAY_PACKET_SIZE
+	const int packetSize = 4;
+	// the tiles at the borders cover the rest of the image
+	const int tileCols = (w + tileSize - 1) / tileSize;
+	const int tileRows = (h + tileSize - 1) / tileSize;
+	const int tileNum = tileCols * tileRows;
+	// adaptive sampling may give a noisy tile a few times the samples of the others
+	const bool isAdaptive = errorThreshold > 0.f;
+	const double curTimeBudget = timeBudget;
+	if (curTimeBudget > 0.0)
+		tileTask.Init(tileCols, tileRows, INT_MAX, INT_MAX, threadNum, curTimeBudget);
+	else
+		tileTask.Init(tileCols, tileRows, tileNum * maxLoop, isAdaptive ? 4 * maxLoop : maxLoop, threadNum, 0.0);
+
+	atomic<int> runningWorkerNum(threadNum);
 	auto renderPartImg = [&](int id) {
 		auto & rayTracer = rayTracers[id];
 
+		// samples of a tile are traced by one call, so wavefront tracers get the whole tile
+		vector<Point2f> posfs(tileSize * tileSize);
+		vector<Point2i> pixels(tileSize * tileSize);
+		vector<ERay> rays(tileSize * tileSize);
+		vector<RGBf> radiances(tileSize * tileSize);
+
+		// lights and BSDFs of this thread draw from the sampler of the tracer
+		auto sampler = rayTracer->GetSampler();
+		Math::SetRandSource(sampler.get());
+
 		for (auto task = tileTask.GetTask(); task.hasTask; task = tileTask.GetTask()) {
+			const auto passStartTime = chrono::steady_clock::now();
 			if (state._value == RendererState::Stop)
-				return;
+				tileTask.Finish();
 
 			int tileID = task.tileID;
-			int tileRow = tileID / rowTiles;
-			int tileCol = tileID - tileRow * rowTiles;
+			int tileRow = tileID / tileCols;
+			int tileCol = tileID - tileRow * tileCols;
 			int baseX = tileCol * tileSize;
 			int baseY = tileRow * tileSize;
 
-			auto filmTile = film->GenFilmTile(Framei({ baseX, baseY }, { baseX + tileSize, baseY + tileSize }));
-
-			for (const auto pos : filmTile->AllPos()) {
-				auto posf = Point2f(pos) + Vec2(Math::Rand_F(), Math::Rand_F());
-				const float u = posf.x / w;
-				const float v = posf.y / h;
+			// the stream only depends on the tile and the sample index, not on the thread,
+			// so a render is reproducible however the tiles are scheduled
+			Math::RandSeed(static_cast<uint64_t>(task.sampleIdx), static_cast<uint64_t>(tileID));
+
+			auto filmTile = film->GenFilmTile(Framei({ baseX, baseY }, { min(baseX + tileSize, w), min(baseY + tileSize, h) }), task.sampleIdx % 2 == 1);
+
+			// camera rays of packetSize x packetSize pixels are in a row
+			const Framei frame = filmTile->GetFrame();
+			int rayNum = 0;
+			for (int packetY = frame.minP.y; packetY < frame.maxP.y; packetY += packetSize) {
+				for (int packetX = frame.minP.x; packetX < frame.maxP.x; packetX += packetSize) {
+					for (int y = packetY; y < min(packetY + packetSize, frame.maxP.y); y++) {
+						for (int x = packetX; x < min(packetX + packetSize, frame.maxP.x); x++) {
+							// the first dimensions of a pixel sample are of the camera ray
+							Point2 jitter;
+							if (sampler) {
+								sampler->StartPixelSample(Point2i(x, y), task.sampleIdx);
+								jitter = sampler->Get2D();
+							}
+							else
+								jitter = Point2(Math::Rand_F(), Math::Rand_F());
+
+							auto posf = Point2f(Point2i(x, y)) + Vec2(jitter.x, jitter.y);
+							const float u = posf.x / w;
+							const float v = posf.y / h;
+
+							posfs[rayNum] = posf;
+							pixels[rayNum] = Point2i(x, y);
+							rays[rayNum] = camera->GenRay(u, v);
+							rayNum++;
+						}
+					}
+				}
+			}
 
-				auto ray = camera->GenRay(u, v);
-				RGBf radiance = rayTracer->Trace(ray);
+			rayTracer->Trace(rays.data(), pixels.data(), task.sampleIdx, rayNum, radiances.data());
 
+			for (int i = 0; i < rayNum; i++) {
+				const RGBf & radiance = radiances[i];
 				if (radiance.HasNaN()) {
 					printf("WARNING::RTX_Renderer::Run:\n"
 						"\t""radiance is NaN\n");
@@ -175,11 +181,20 @@ void RTX_Renderer::Run(Ptr<Scene> scene, Ptr<Image> img) {
 				//if (illum > lightNum)
 				//	radiance *= lightNum / illum;
 
-				filmTile->AddSample(posf, radiance);
+				filmTile->AddSample(posfs[i], radiance);
 			}
 
 			film->MergeFilmTile(filmTile);
+
+			// as many odd passes as even ones, so that the error estimate is fair
+			const int sampleNum = task.sampleIdx + 1;
+			const bool isConverged = isAdaptive && sampleNum >= minLoop && sampleNum % 2 == 0
+				&& film->Error(filmTile->GetFrame()) < errorThreshold;
+			tileTask.Done(task, isConverged, chrono::duration<double>(chrono::steady_clock::now() - passStartTime).count());
 		}
+
+		Math::SetRandSource(nullptr);
+		runningWorkerNum--;
 	};
 
 	// init all workers first
@@ -187,9 +202,16 @@ void RTX_Renderer::Run(Ptr<Scene> scene, Ptr<Image> img) {
 	for (int i = 0; i < threadNum; i++)
 		workers.push_back(thread(renderPartImg, i));
 
+	// the image is resolved at display rate while the workers run
+	while (runningWorkerNum > 0) {
+		film->Resolve();
+		this_thread::sleep_for(chrono::milliseconds(33));
+	}
+
 	// wait workers
 	for (auto & worker : workers)
 		worker.join();
+	film->Resolve();
 
 	state = RendererState::Stop;
 }
@@ -199,5 +221,291 @@ void RTX_Renderer::Stop() {
 }
 
 float RTX_Renderer::ProgressRate() {
-	return Math::Clamp((float(tileTask.GetCurLoop()) + 0.5f) / float(maxLoop), 0.f, 1.f);
+	return Math::Clamp(tileTask.GetProgress(), 0.f, 1.f);
+}
+
+double RTX_Renderer::EstimateRemainingTime() {
+	return tileTask.EstimateRemainingTime();
+}
+
+void RTX_Renderer::TileTask::Init(int tileCols, int tileRows, int maxPassNum, int maxSampleNum, int workerNum, double timeBudget) {
+	const int newTileNum = tileCols * tileRows;
+	auto newOrder = HilbertOrder(tileCols, tileRows);
+	unique_ptr<Tile[]> newTiles(new Tile[newTileNum]);
+	for (int i = 0; i < newTileNum; i++) {
+		newTiles[i].sampleNum = 0;
+		newTiles[i].doneNum = 0;
+		newTiles[i].passTimeSum = 0.0;
+		newTiles[i].isBusy = false;
+		newTiles[i].isConverged = false;
+	}
+
+	// the old tiles are freed after the lock, no query reads them any more
+	lock_guard<mutex> lock(stateLock);
+	tileNum = newTileNum;
+	this->maxSampleNum = maxSampleNum;
+	this->maxPassNum = maxPassNum;
+	this->workerNum = max(workerNum, 1);
+	this->timeBudget = timeBudget;
+	startTime = chrono::steady_clock::now();
+	order.swap(newOrder);
+	tiles.swap(newTiles);
+	nextTask = 0;
+	passNum = 0;
+	roundSampleNum = 0;
+	isFinishCalled = false;
+	isFinishing = false;
+	finishSampleNum = 0;
+}
+
+const vector<int> RTX_Renderer::TileTask::HilbertOrder(int tileCols, int tileRows) {
+	int n = 1;
+	while (n < tileCols || n < tileRows)
+		n *= 2;
+
+	vector<int> order;
+	order.reserve(tileCols * tileRows);
+	for (int d = 0; d < n * n; d++) {
+		// index d on the curve to (x, y)
+		int x = 0;
+		int y = 0;
+		for (int s = 1, t = d; s < n; s *= 2, t /= 4) {
+			const int rx = 1 & (t / 2);
+			const int ry = 1 & (t ^ rx);
+			if (ry == 0) {
+				if (rx == 1) {
+					x = s - 1 - x;
+					y = s - 1 - y;
+				}
+				swap(x, y);
+			}
+			x += s * rx;
+			y += s * ry;
+		}
+
+		if (x < tileCols && y < tileRows)
+			order.push_back(y * tileCols + x);
+	}
+	return order;
+}
+
+int RTX_Renderer::TileTask::SampleNumLimit() const {
+	return isFinishing ? min(maxSampleNum, static_cast<int>(finishSampleNum)) : maxSampleNum;
+}
+
+bool RTX_Renderer::TileTask::HasWork() const {
+	const int limit = SampleNumLimit();
+	for (int i = 0; i < tileNum; i++) {
+		if (!tiles[i].isConverged && tiles[i].sampleNum < limit)
+			return true;
+	}
+	return false;
+}
+
+int RTX_Renderer::TileTask::MaxUnconvergedSampleNum() const {
+	int rst = 0;
+	for (int i = 0; i < tileNum; i++) {
+		if (!tiles[i].isConverged)
+			rst = max(rst, static_cast<int>(tiles[i].sampleNum));
+	}
+	return rst;
+}
+
+double RTX_Renderer::TileTask::GetElapsedTime() const {
+	return chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+}
+
+bool RTX_Renderer::TileTask::EstimatePasses(int sampleNum, double & passNumSum, double & passTimeSum) const {
+	double timeSum = 0.0;
+	int doneSum = 0;
+	for (int i = 0; i < tileNum; i++) {
+		timeSum += tiles[i].passTimeSum;
+		doneSum += tiles[i].doneNum;
+	}
+	if (doneSum == 0)
+		return false;
+
+	// tiles differ a lot in cost, so each takes its own mean time of a pass
+	const double meanPassTime = timeSum / doneSum;
+	passNumSum = 0.0;
+	passTimeSum = 0.0;
+	for (int i = 0; i < tileNum; i++) {
+		const int tileSampleNum = tiles[i].sampleNum;
+		if (tiles[i].isConverged || tileSampleNum >= sampleNum)
+			continue;
+
+		const int doneNum = tiles[i].doneNum;
+		const double tilePassNum = static_cast<double>(sampleNum) - tileSampleNum;
+		const double tilePassTime = doneNum > 0 ? tiles[i].passTimeSum / doneNum : meanPassTime;
+		passNumSum += tilePassNum;
+		passTimeSum += tilePassNum * tilePassTime;
+	}
+	return true;
+}
+
+double RTX_Renderer::TileTask::EstimateTime(int sampleNum) const {
+	double passNumSum, passTimeSum;
+	if (!EstimatePasses(sampleNum, passNumSum, passTimeSum))
+		return -1.0;
+
+	return passTimeSum / workerNum;
+}
+
+bool RTX_Renderer::TileTask::IsRoundInBudget() const {
+	if (timeBudget <= 0.0)
+		return true;
+
+	// the passes of the current round are issued, a new round is one more pass of each tile
+	const double roundTime = EstimateTime(roundSampleNum + 1);
+	return roundTime < 0.0 || GetElapsedTime() + roundTime <= timeBudget;
+}
+
+const RTX_Renderer::TileTask::Task RTX_Renderer::TileTask::GetTask() {
+	if (timeBudget > 0.0 && !isFinishing && GetElapsedTime() >= timeBudget)
+		Finish();
+
+	for (;;) {
+		// any Done or Finish after this may free a tile the round below skips
+		const unsigned curEventNum = eventNum;
+
+		// a round over the curve, the converged tiles and the busy ones are skipped
+		for (int i = 0; i < tileNum; i++) {
+			const int tileID = order[nextTask++ % tileNum];
+			Tile & tile = tiles[tileID];
+			if (tile.isConverged || tile.sampleNum >= SampleNumLimit() || tile.isBusy)
+				continue;
+			if (tile.isBusy.exchange(true))
+				continue;
+
+			// a round is not started if it would overrun the time budget, the run ends with the current one
+			if (!isFinishing && tile.sampleNum >= roundSampleNum && !IsRoundInBudget()) {
+				tile.isBusy = false;
+				Finish();
+				continue;
+			}
+
+			// the sample is issued before the limit is checked again,
+			// so that Finish sees it or this worker sees the limit of Finish
+			const int sampleIdx = tile.sampleNum++;
+			if (tile.isConverged || sampleIdx >= SampleNumLimit()) {
+				tile.sampleNum--;
+				tile.isBusy = false;
+				continue;
+			}
+
+			if (passNum++ >= maxPassNum) {
+				tile.sampleNum--;
+				tile.isBusy = false;
+				// the workers waiting for this tile end too
+				Notify();
+				return Task(false);
+			}
+
+			for (int curRoundSampleNum = roundSampleNum; sampleIdx >= curRoundSampleNum;) {
+				if (roundSampleNum.compare_exchange_weak(curRoundSampleNum, sampleIdx + 1))
+					break;
+			}
+
+			return Task(true, tileID, sampleIdx);
+		}
+
+		if (!HasWork())
+			return Task(false);
+
+		// the remaining tiles are being rendered by other workers, sleep until one of them is done
+		unique_lock<mutex> lock(idleLock);
+		idleWorkerNum++;
+		idleCondition.wait(lock, [&]() { return eventNum != curEventNum; });
+		idleWorkerNum--;
+	}
+}
+
+void RTX_Renderer::TileTask::Notify() {
+	eventNum++;
+	// a worker counts itself idle before it checks eventNum,
+	// so it either sees the new eventNum or is counted here and woken
+	if (idleWorkerNum > 0) {
+		lock_guard<mutex> lock(idleLock);
+		idleCondition.notify_all();
+	}
+}
+
+void RTX_Renderer::TileTask::Done(const Task & task, bool isConverged, double seconds) {
+	Tile & tile = tiles[task.tileID];
+	tile.doneNum++;
+	tile.passTimeSum = tile.passTimeSum + seconds;
+	tile.isConverged = isConverged;
+	tile.isBusy = false;
+	Notify();
+}
+
+void RTX_Renderer::TileTask::Finish() {
+	if (isFinishCalled.exchange(true))
+		return;
+
+	// passes already issued count, so the target is met by the passes in flight or one more
+	// a pass issued while the target is set raises it again
+	int target = MaxUnconvergedSampleNum();
+	finishSampleNum = target;
+	isFinishing = true;
+	for (int newTarget = MaxUnconvergedSampleNum(); newTarget > target; newTarget = MaxUnconvergedSampleNum()) {
+		target = newTarget;
+		finishSampleNum = target;
+	}
+
+	// idle workers may have no tile left below the target
+	Notify();
+}
+
+float RTX_Renderer::TileTask::GetProgress() const {
+	lock_guard<mutex> lock(stateLock);
+	if (tileNum == 0)
+		return 0.f;
+
+	int convergedNum = 0;
+	for (int i = 0; i < tileNum; i++) {
+		if (tiles[i].isConverged)
+			convergedNum++;
+	}
+	if (convergedNum == tileNum)
+		return 1.f;
+
+	float progress = maxPassNum == 0 ? 1.f : (min(static_cast<int>(passNum), maxPassNum) + 0.5f) / maxPassNum;
+	if (timeBudget > 0.0)
+		progress = max(progress, static_cast<float>(GetElapsedTime() / timeBudget));
+	return progress;
+}
+
+double RTX_Renderer::TileTask::EstimateRemainingTime() const {
+	lock_guard<mutex> lock(stateLock);
+	double passNumSum, passTimeSum;
+	if (!EstimatePasses(SampleNumLimit(), passNumSum, passTimeSum))
+		return -1.0;
+	if (passNumSum == 0.0)
+		return 0.0;
+
+	// the passes left of the budget are spread over the tiles as the tiles need them
+	const double remainingPassNum = min(passNumSum, static_cast<double>(maxPassNum) - min(static_cast<int>(passNum), maxPassNum));
+	double remainingTime = remainingPassNum * (passTimeSum / passNumSum) / workerNum;
+	if (timeBudget <= 0.0 || isFinishing)
+		return remainingTime;
+
+	// the current round is finished, then the rounds which are estimated to end within the time budget are run
+	const int curSampleNum = roundSampleNum;
+	const double curRoundTime = EstimateTime(curSampleNum);
+	const double roundTime = EstimateTime(curSampleNum + 1) - curRoundTime;
+	double budgetTime = curRoundTime;
+	if (roundTime > 0.0)
+		budgetTime += max(floor((timeBudget - GetElapsedTime() - curRoundTime) / roundTime), 0.0) * roundTime;
+
+	// unless the tiles converge before
+	return min(remainingTime, budgetTime);
+}
+
+const vector<int> RTX_Renderer::TileTask::GetSampleNums() const {
+	lock_guard<mutex> lock(stateLock);
+	vector<int> sampleNums(tileNum);
+	for (int i = 0; i < tileNum; i++)
+		sampleNums[i] = tiles[i].sampleNum;
+	return sampleNums;
 }
@@ -0,0 +1,200 @@
+#include <CppUtil/Engine/WavefrontPathTracer.h>
+
+#include <CppUtil/Engine/BVHAccel.h>
+
+#include <CppUtil/Engine/RayIntersector.h>
+#include <CppUtil/Engine/VisibilityChecker.h>
+
+#include <CppUtil/Engine/BSDF.h>
+
+#include <CppUtil/Basic/Math.h>
+
+#include <algorithm>
+#include <typeinfo>
+
+using namespace CppUtil;
+using namespace CppUtil::Engine;
+using namespace CppUtil::Basic;
+using namespace std;
+
+namespace {
+	// 10 bits of x to every third bit
+	uint64_t ExpandBits(uint64_t x) {
+		x = (x | (x << 16)) & 0x030000FF;
+		x = (x | (x << 8)) & 0x0300F00F;
+		x = (x | (x << 4)) & 0x030C30C3;
+		x = (x | (x << 2)) & 0x09249249;
+		return x;
+	}
+}
+
+WavefrontPathTracer::WavefrontPathTracer()
+	: maxBatchSize(1 << 16) { }
+
+void WavefrontPathTracer::Trace(ERay * rays, const Point2i * pixels, const int sampleIdx, const int num, RGBf * radiances) {
+	for (int first = 0; first < num; first += maxBatchSize)
+		TraceBatch(rays + first, pixels + first, sampleIdx, min(maxBatchSize, num - first), radiances + first);
+}
+
+void WavefrontPathTracer::TraceBatch(ERay * rays, const Point2i * pixels, const int sampleIdx, const int num, RGBf * radiances) {
+	// buffers only grow, so they are allocated once
+	if (static_cast<int>(rayArr.size()) < num) {
+		rayArr.resize(num);
+		throughputArr.resize(num);
+		rstArr.resize(num);
+		hitArr.resize(num);
+		activeQueue.resize(num);
+		nextQueue.resize(num);
+		shadowRayArr.resize(num);
+		shadowPathArr.resize(num);
+		shadowLArr.resize(num);
+		shadowQueue.resize(num);
+		keyArr.resize(num);
+	}
+
+	for (int i = 0; i < num; i++) {
+		rayArr[i] = rays[i];
+		throughputArr[i] = RGBf(1.f);
+		radiances[i] = RGBf(0.f);
+		activeQueue[i] = i;
+	}
+
+	int activeNum = num;
+	for (int depth = 0; activeNum > 0; depth++) {
+		// camera rays come in packets of nearby pixels, the bounces are sorted into packets
+		if (depth > 0) {
+			ComputeRayKeys(activeQueue, activeNum, rayArr);
+			SortQueue(activeQueue, activeNum);
+		}
+		Extend(activeNum);
+
+		int nextNum;
+		int shadowNum;
+		Shade(activeNum, depth, pixels, sampleIdx, radiances, nextNum, shadowNum);
+
+		Shadow(shadowNum, radiances);
+
+		swap(activeQueue, nextQueue);
+		activeNum = nextNum;
+	}
+}
+
+void WavefrontPathTracer::Extend(const int activeNum) {
+	for (int first = 0; first < activeNum; first += RAY_PACKET_SIZE) {
+		const int num = min(RAY_PACKET_SIZE, activeNum - first);
+
+		ERay rays[RAY_PACKET_SIZE];
+		RayIntersector::Rst rsts[RAY_PACKET_SIZE];
+		for (int i = 0; i < num; i++)
+			rays[i] = rayArr[activeQueue[first + i]];
+
+		rayIntersector->IntersectPacket(*bvhAccel, rays, num, rsts);
+
+		for (int i = 0; i < num; i++) {
+			const int pathIdx = activeQueue[first + i];
+			rayArr[pathIdx].tMax = rays[i].tMax;
+			rstArr[pathIdx] = rsts[i];
+		}
+	}
+}
+
+void WavefrontPathTracer::Shade(const int activeNum, const int depth, const Point2i * pixels, const int sampleIdx, RGBf * radiances, int & nextNum, int & shadowNum) {
+	// surfaces of the hits, the ended paths are dropped from the queue
+	int hitNum = 0;
+	for (int i = 0; i < activeNum; i++) {
+		const int pathIdx = activeQueue[i];
+		auto & hit = hitArr[pathIdx];
+		radiances[pathIdx] += throughputArr[pathIdx] * BeginShade(rayArr[pathIdx], rstArr[pathIdx], depth, hit);
+		if (!hit.bsdf)
+			continue;
+
+		keyArr[pathIdx] = static_cast<uint64_t>(typeid(*hit.bsdf).hash_code());
+		activeQueue[hitNum++] = pathIdx;
+	}
+
+	// paths of the same type of BSDF run the same code one after another
+	SortQueue(activeQueue, hitNum);
+
+	nextNum = 0;
+	shadowNum = 0;
+	for (int i = 0; i < hitNum; i++) {
+		const int pathIdx = activeQueue[i];
+		auto & hit = hitArr[pathIdx];
+		const RGBf & pathThroughput = throughputArr[pathIdx];
+
+		// the stages take the same dimensions as in PathTracer, so the order of the paths does not matter
+		StartPixelSample(pixels[pathIdx], sampleIdx);
+		StartSampleStage(depth, LIGHT_SAMPLE_DIM);
+		const RGBf lightL = SampleRandomLight(hit.pos, hit.worldToSurface, hit.bsdf, hit.w_out, hit.texcoord, shadowRayArr[shadowNum]);
+		if (!lightL.IsZero()) {
+			shadowPathArr[shadowNum] = pathIdx;
+			shadowLArr[shadowNum] = pathThroughput * lightL;
+			shadowNum++;
+		}
+
+		ERay matRay;
+		RGBf weight;
+		StartSampleStage(depth, BSDF_SAMPLE_DIM);
+		if (SampleNextRay(hit.bsdf, SampleLightMode::RandomOne, hit.w_out, hit.surfaceToWorld, hit.texcoord, hit.pos, depth, pathThroughput, matRay, weight)) {
+			rayArr[pathIdx] = matRay;
+			throughputArr[pathIdx] *= weight;
+			nextQueue[nextNum++] = pathIdx;
+		}
+
+		// the material is not held beyond the bounce
+		hit.bsdf = nullptr;
+	}
+}
+
+void WavefrontPathTracer::Shadow(const int shadowNum, RGBf * radiances) {
+	for (int i = 0; i < shadowNum; i++)
+		shadowQueue[i] = i;
+	ComputeRayKeys(shadowQueue, shadowNum, shadowRayArr);
+	SortQueue(shadowQueue, shadowNum);
+
+	for (int first = 0; first < shadowNum; first += RAY_PACKET_SIZE) {
+		const int num = min(RAY_PACKET_SIZE, shadowNum - first);
+
+		ERay rays[RAY_PACKET_SIZE];
+		for (int i = 0; i < num; i++)
+			rays[i] = shadowRayArr[shadowQueue[first + i]];
+
+		const int occludedMask = visibilityChecker->IntersectPacket(*bvhAccel, rays, num);
+		for (int i = 0; i < num; i++) {
+			if (occludedMask & (1 << i))
+				continue;
+
+			const int shadowIdx = shadowQueue[first + i];
+			radiances[shadowPathArr[shadowIdx]] += shadowLArr[shadowIdx];
+		}
+	}
+}
+
+void WavefrontPathTracer::ComputeRayKeys(const vector<int> & queue, const int num, const vector<ERay> & rays) {
+	const BBoxf box = bvhAccel->GetTLAS().GetBox();
+	Val3f scale;
+	for (int axis = 0; axis < 3; axis++) {
+		const float extent = box.maxP[axis] - box.minP[axis];
+		scale[axis] = extent > 0 ? 1023.f / extent : 0.f;
+	}
+
+	for (int i = 0; i < num; i++) {
+		const int idx = queue[i];
+		const auto & ray = rays[idx];
+
+		uint64_t code = 0;
+		uint64_t octant = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			const float q = Math::Clamp((ray.o[axis] - box.minP[axis]) * scale[axis], 0.f, 1023.f);
+			code |= ExpandBits(static_cast<uint64_t>(q)) << (2 - axis);
+			octant |= static_cast<uint64_t>(ray.d[axis] < 0) << axis;
+		}
+		keyArr[idx] = (octant << 30) | code;
+	}
+}
+
+void WavefrontPathTracer::SortQueue(vector<int> & queue, const int num) const {
+	sort(queue.begin(), queue.begin() + num, [this](int lhs, int rhs) {
+		return keyArr[lhs] < keyArr[rhs] || (keyArr[lhs] == keyArr[rhs] && lhs < rhs);
+	});
+}
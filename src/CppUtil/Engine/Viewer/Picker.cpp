@@ -41,9 +41,14 @@ void Picker::Init() {
 		Vec3 dir = (posInWorld - camera->GetPos()).Normalize();
 		Ray ray(camera->GetPos(), dir);
 		rayIntersector->Init(&ray);
-		viewer->GetScene()->GetRoot()->Accept(rayIntersector);
+		auto root = viewer->GetScene()->GetRoot();
+		root->Accept(rayIntersector);
 		auto closestRst = rayIntersector->GetRst();
-		Ui::Attribute::GetInstance()->SetSObj(closestRst.closestSObj);
+		// the intersector only keeps a raw pointer, HeapObj hides shared_from_this, so it is called on the base
+		Ptr<SObj> sobj;
+		if (closestRst.closestSObj)
+			sobj = CastTo<SObj>(static_cast<std::enable_shared_from_this<HeapObj> *>(closestRst.closestSObj)->shared_from_this());
+		Ui::Attribute::GetInstance()->SetSObj(sobj);
 	}, true);
 	EventMngr::GetInstance().Reg(Qt::LeftButton, (void*)viewer->GetOGLW(), EventMngr::MOUSE_PRESS, MRB_PressOp);
 }
@@ -0,0 +1,262 @@
+#include <CppUtil/Engine/BVHAccel.h>
+#include <CppUtil/Engine/RayIntersector.h>
+#include <CppUtil/Engine/VisibilityChecker.h>
+#include <CppUtil/Engine/Ray.h>
+
+#include <CppUtil/Engine/SObj.h>
+#include <CppUtil/Engine/CmptGeometry.h>
+#include <CppUtil/Engine/CmptTransform.h>
+
+#include <CppUtil/Engine/Sphere.h>
+#include <CppUtil/Engine/Capsule.h>
+#include <CppUtil/Engine/TriMesh.h>
+
+#include <CppUtil/Basic/Math.h>
+#include <CppUtil/Basic/Timer.h>
+
+#include <ROOT_PATH.h>
+
+#include <atomic>
+#include <cfloat>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace CppUtil;
+using namespace CppUtil::Engine;
+using namespace CppUtil::Basic;
+using namespace std;
+
+// debug allocation counter, tracing must not allocate
+static atomic<size_t> allocNum{ 0 };
+
+void * operator new(size_t size) {
+	allocNum++;
+	if (void * mem = malloc(size))
+		return mem;
+	throw bad_alloc();
+}
+
+void operator delete(void * mem) noexcept {
+	free(mem);
+}
+
+Ptr<SObj> GenScene(int n) {
+	auto root = SObj::New(nullptr, "root");
+	auto sphereMesh = TriMesh::GenSphere();
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			auto sobj = SObj::New(root, "sobj");
+			const Point3 pos(i - n / 2.f, Math::Rand_F(), j - n / 2.f);
+			CmptTransform::New(sobj, pos, Scalef(0.3f));
+
+			Ptr<Primitive> primitive;
+			switch ((i + j) % 3) {
+			case 0:
+				primitive = Sphere::New();
+				break;
+			case 1:
+				primitive = Capsule::New();
+				break;
+			default:
+				primitive = sphereMesh;
+				break;
+			}
+			CmptGeometry::New(sobj, primitive);
+		}
+	}
+	return root;
+}
+
+// closest hit of a ray, sobj is nullptr for a miss
+struct Hit {
+	float t;
+	SObj * sobj;
+};
+
+bool IsSameHit(const Hit & lhs, const Hit & rhs) {
+	if (lhs.sobj != rhs.sobj)
+		return false;
+	return lhs.sobj == nullptr || abs(lhs.t - rhs.t) <= 1e-4f * max(1.f, rhs.t);
+}
+
+// number of rays whose hit is not the one of the reference
+int DiffNum(const vector<Hit> & hits, const vector<Hit> & refHits) {
+	int diffNum = 0;
+	for (size_t i = 0; i < hits.size(); i++) {
+		if (!IsSameHit(hits[i], refHits[i]))
+			diffNum++;
+	}
+	return diffNum;
+}
+
+// hits of the rays from (0, 20, 0) along dirs
+// packets must agree with single rays ray by ray, and shadow rays with the hits, and tracing must not allocate
+bool Trace(Ptr<BVHAccel> bvhAccel, const vector<Vec3> & dirs, vector<Hit> & hits) {
+	auto rayIntersector = RayIntersector::New();
+	auto visibilityChecker = VisibilityChecker::New();
+
+	const int rayNum = static_cast<int>(dirs.size());
+	hits.resize(rayNum);
+	vector<Hit> packetHits(rayNum);
+	int hitNum = 0;
+	int occludedNum = 0;
+	int occludedDiffNum = 0;
+	Timer timer(true);
+	const size_t allocNumBegin = allocNum;
+	for (int i = 0; i < rayNum; i++) {
+		const Point3 origin(0, 20, 0);
+		ERay ray(origin, dirs[i]);
+
+		rayIntersector->Init(&ray);
+		rayIntersector->Intersect(*bvhAccel);
+		const auto & rst = rayIntersector->GetRst();
+		hits[i] = { ray.tMax, rst.closestSObj };
+		if (rst.IsIntersect())
+			hitNum++;
+
+		// unbounded, so that it agrees with the closest hit
+		ERay shadowRay(origin, dirs[i]);
+		visibilityChecker->Init(shadowRay, FLT_MAX);
+		visibilityChecker->Intersect(*bvhAccel);
+		const bool isOccluded = visibilityChecker->GetRst().IsIntersect();
+		if (isOccluded)
+			occludedNum++;
+		if (isOccluded != rst.IsIntersect())
+			occludedDiffNum++;
+	}
+	timer.Stop();
+	const size_t tracingAllocNum = allocNum - allocNumBegin;
+
+	printf("%d rays, %d hit, %d occluded\n", rayNum, hitNum, occludedNum);
+	printf("%f Mrays/s, %zd allocations\n", 2 * rayNum / timer.GetWholeTime() / 1e6, tracingAllocNum);
+
+	int packetOccludedDiffNum = 0;
+	Timer packetTimer(true);
+	const size_t packetAllocNumBegin = allocNum;
+	for (int first = 0; first < rayNum; first += RAY_PACKET_SIZE) {
+		const int num = min(RAY_PACKET_SIZE, rayNum - first);
+		ERay rays[RAY_PACKET_SIZE];
+		ERay shadowRays[RAY_PACKET_SIZE];
+		for (int i = 0; i < num; i++) {
+			rays[i] = ERay(Point3(0, 20, 0), dirs[first + i]);
+			shadowRays[i] = ERay(Point3(0, 20, 0), dirs[first + i]);
+		}
+
+		RayIntersector::Rst rsts[RAY_PACKET_SIZE];
+		rayIntersector->IntersectPacket(*bvhAccel, rays, num, rsts);
+		for (int i = 0; i < num; i++)
+			packetHits[first + i] = { rays[i].tMax, rsts[i].closestSObj };
+
+		const int occludedMask = visibilityChecker->IntersectPacket(*bvhAccel, shadowRays, num);
+		for (int i = 0; i < num; i++) {
+			if (((occludedMask >> i) & 1) != (rsts[i].IsIntersect() ? 1 : 0))
+				packetOccludedDiffNum++;
+		}
+	}
+	packetTimer.Stop();
+	const size_t packetAllocNum = allocNum - packetAllocNumBegin;
+
+	const int packetDiffNum = DiffNum(packetHits, hits);
+	printf("packets: %d hits differ, %d occlusions differ\n", packetDiffNum, packetOccludedDiffNum);
+	printf("%f Mrays/s, %zd allocations\n", 2 * rayNum / packetTimer.GetWholeTime() / 1e6, packetAllocNum);
+
+	return occludedDiffNum == 0 && tracingAllocNum == 0
+		&& packetDiffNum == 0 && packetOccludedDiffNum == 0 && packetAllocNum == 0;
+}
+
+// trace and compare with the hits of the reference ray by ray
+bool Check(Ptr<BVHAccel> bvhAccel, const vector<Vec3> & dirs, const vector<Hit> & refHits, const char * name) {
+	vector<Hit> hits;
+	const bool isValid = Trace(bvhAccel, dirs, hits);
+	const int diffNum = DiffNum(hits, refHits);
+	if (isValid && diffNum == 0)
+		return true;
+
+	printf("ERROR: %s traversal check failed, %d hits differ from the reference\n", name, diffNum);
+	return false;
+}
+
+int main() {
+	auto root = GenScene(64);
+	auto bvhAccel = BVHAccel::New();
+	bvhAccel->Init(root);
+
+	const int rayNum = 1 << 20;
+	vector<Vec3> dirs;
+	dirs.reserve(rayNum);
+	for (int i = 0; i < rayNum; i++) {
+		const Point3 target(64 * (Math::Rand_F() - 0.5f), 0, 64 * (Math::Rand_F() - 0.5f));
+		dirs.push_back((target - Point3(0, 20, 0)).Normalize());
+	}
+
+	// SAH single rays are the reference
+	vector<Hit> refHits;
+	if (!Trace(bvhAccel, dirs, refHits)) {
+		printf("ERROR: BVH traversal check failed\n");
+		return 1;
+	}
+
+	// other build modes must not change what is hit
+	const BVHAccel::BuildMode modes[] = { BVHAccel::BuildMode::SBVH, BVHAccel::BuildMode::LBVH, BVHAccel::BuildMode::HLBVH };
+	const char * modeNames[] = { "SBVH", "LBVH", "HLBVH" };
+	for (int i = 0; i < 3; i++) {
+		bvhAccel->SetBuildMode(modes[i]);
+		bvhAccel->Init(root);
+		if (!Check(bvhAccel, dirs, refHits, modeNames[i]))
+			return 1;
+	}
+
+	// compressed nodes are conservative, so they hit the same
+	bvhAccel->SetBuildMode(BVHAccel::BuildMode::SAH);
+	bvhAccel->SetCompressed(true);
+	bvhAccel->Init(root);
+	if (!Check(bvhAccel, dirs, refHits, "compressed"))
+		return 1;
+	bvhAccel->SetCompressed(false);
+	bvhAccel->Init(root);
+
+	// trees saved to the disk cache must load to the same hits
+	// new accels, the bottom levels in memory would skip the cache
+	const string cacheDir = ROOT_PATH + "data/cache/bvh/";
+	auto savedBVHAccel = BVHAccel::New();
+	savedBVHAccel->SetCacheDir(cacheDir);
+	savedBVHAccel->Init(root);
+	auto loadedBVHAccel = BVHAccel::New();
+	loadedBVHAccel->SetCacheDir(cacheDir);
+	loadedBVHAccel->Init(root);
+	if (loadedBVHAccel->GetLoadedTreeNum() == 0) {
+		printf("ERROR: no tree is loaded from the BVH cache\n");
+		return 1;
+	}
+	if (!Check(loadedBVHAccel, dirs, refHits, "cached"))
+		return 1;
+
+	// moves are refit, the hits must be the ones of a new build
+	for (auto transform : root->GetComponentsInChildren<CmptTransform>())
+		transform->Translate(0.1f * Vec3(Math::Rand_F() - 0.5f, Math::Rand_F() - 0.5f, Math::Rand_F() - 0.5f));
+	bvhAccel->Update(root);
+	auto movedBVHAccel = BVHAccel::New();
+	movedBVHAccel->Init(root);
+	vector<Hit> movedHits;
+	if (!Trace(movedBVHAccel, dirs, movedHits) || !Check(bvhAccel, dirs, movedHits, "refit"))
+		return 1;
+
+	// primitives edited in place are rebuilt
+	for (auto geo : root->GetComponentsInChildren<CmptGeometry>()) {
+		if (auto capsule = dynamic_pointer_cast<Capsule>(geo->primitive))
+			capsule->height = 3.f;
+	}
+	bvhAccel->Update(root);
+	auto editedBVHAccel = BVHAccel::New();
+	editedBVHAccel->Init(root);
+	vector<Hit> editedHits;
+	if (!Trace(editedBVHAccel, dirs, editedHits) || !Check(bvhAccel, dirs, editedHits, "edited capsule"))
+		return 1;
+
+	return 0;
+}